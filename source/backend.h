@@ -0,0 +1,28 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+#include "drawlist.h"
+
+// The renderer behind draw.c, chosen at link time: draw.gl.c or draw.soft.c.
+// Textures and buffers are handles that only the backend interprets; a backend
+// without buffer objects returns 0 from backend_buffer and draws cached geometry
+// straight from the client copy.  backend_resize follows a change of VIEW_SCALE; the
+// projection is in view units, so only the viewport and frame-sized targets change.
+// backend_decode_backdrop makes no GL calls, so it can run on any thread; it returns
+// pixels in whatever form backend_backdrop uploads, which the caller frees.
+// backend_buffer_age is how many frames ago the target about to be drawn was last
+// drawn, or 0 if its contents are undefined; draw.c widens the damage to suit.
+
+void         backend_init();
+void         backend_shutdown();
+void         backend_resize();
+int          backend_buffer_age();
+unsigned char *backend_decode_backdrop(const char **image);
+unsigned int backend_backdrop(const unsigned char *pixels);
+unsigned int backend_texture(int width, int height, const unsigned char *rgba);
+void         backend_delete_texture(unsigned int texture);
+unsigned int backend_buffer();
+void         backend_upload(unsigned int buffer, const Vertex *vertices, int count);
+void         backend_delete_buffer(unsigned int buffer);
+void         backend_submit(const DrawList *list);
@@ -0,0 +1,428 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// Microbenchmarks for the game logic and asset codecs.  The game logic is static to
+// game.c, so it is included directly.  Nothing here touches the window or GL: the
+// benchmark links the software renderer, and defines the few OS functions it needs.
+//
+// Usage: tetrita-bench [-csv | -json] [-seed N] [-samples N] [filter]
+
+#include "game.c"
+#include "image.h"
+
+#define PIECE_SET   1024
+#define BOARD_SET   64
+#define TEXT_SIZE   4096
+#define DXT5_SIZE   (480 * 320)
+#define DXT5_CHARS  (DXT5_SIZE * 4 / 3)
+#define DXT5_ROWS   (DXT5_CHARS / 128 + 2)
+#define TARGET_USEC 2000
+#define WARMUP_USEC 50000
+
+typedef enum
+{
+    EText,
+    ECsv,
+    EJson,
+} Format;
+
+typedef struct
+{
+    const char *name;
+    void (*setup)();
+    int (*run)();
+} Benchmark;
+
+static unsigned int base_seed = 1;
+static unsigned int seed;
+static Piece pieces[PIECE_SET];
+static TileRow boards[BOARD_SET][ROW_COUNT];
+static Game games[BOARD_SET];
+static const char *dxt5_strings[DXT5_ROWS];
+static char dxt5_text[DXT5_CHARS + DXT5_ROWS];
+static unsigned char *buffer;
+static char text[TEXT_SIZE];
+static volatile int sink;
+
+static unsigned int next_random();
+static void random_board(TileRow *board);
+static void setup_pieces();
+static void setup_games();
+static void setup_buffer();
+static void setup_dxt5();
+static void setup_text();
+static int run_collide();
+static int run_lock_piece();
+static int run_check_completions();
+static int run_nuke_lines();
+static int run_decode_tiles();
+static int run_decode_backdrop();
+static int run_decode_dxt1();
+static int run_decode_dxt5();
+static int run_font_glyph();
+static int run_font_kerning();
+static int compare(const void *a, const void *b);
+
+static const Benchmark benchmarks[] =
+{
+    { "collide",            setup_pieces,   run_collide },
+    { "lock_piece",         setup_pieces,   run_lock_piece },
+    { "check_completions",  setup_games,    run_check_completions },
+    { "nuke_lines",         setup_games,    run_nuke_lines },
+    { "decode_tiles",       setup_buffer,   run_decode_tiles },
+    { "decode_backdrop",    setup_buffer,   run_decode_backdrop },
+    { "decode_dxt1",        setup_buffer,   run_decode_dxt1 },
+    { "decode_dxt5",        setup_dxt5,     run_decode_dxt5 },
+    { "font_glyph",         setup_text,     run_font_glyph },
+    { "font_kerning",       setup_text,     run_font_kerning },
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    Format format = EText;
+    const char *filter = 0;
+    int sample_count = 31;
+    double *samples;
+    unsigned int b;
+    int i, reported = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-csv"))
+            format = ECsv;
+        else if (!strcmp(argv[i], "-json"))
+            format = EJson;
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+            base_seed = (unsigned int) atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-samples") && i + 1 < argc)
+            sample_count = atoi(argv[++i]);
+        else
+            filter = argv[i];
+    }
+
+    base_seed = max(1u, base_seed);
+    sample_count = max(1, sample_count);
+    buffer = (unsigned char *) malloc(4 * 480 * 320 + 1);
+    samples = (double *) malloc(sample_count * sizeof(double));
+
+    if (format == ECsv)
+        printf("name,median_ns,mad_ns,samples,iterations,seed\n");
+    else if (format == EJson)
+        printf("[");
+    else
+        printf("%-20s %12s %12s %10s\n", "benchmark", "median ns", "mad ns", "iters");
+
+    for (b = 0; b < BENCHMARK_COUNT; b++)
+    {
+        const Benchmark *bench = benchmarks + b;
+        unsigned long long start, elapsed;
+        double median, mad;
+        int iterations, operations, s;
+
+        if (filter && !strstr(bench->name, filter))
+            continue;
+
+        // Reseed for every benchmark so each one sees the same inputs regardless of the filter.
+        seed = base_seed;
+        srand(seed);
+        bench->setup();
+
+        // Warm up caches and the branch predictors, then size each sample to a fixed duration.
+        iterations = 0;
+        start = osGetMicroseconds();
+        do
+        {
+            bench->run();
+            iterations++;
+        }
+        while (osGetMicroseconds() - start < WARMUP_USEC);
+        elapsed = osGetMicroseconds() - start;
+        iterations = max(1, (int) (iterations * TARGET_USEC / (elapsed + 1)));
+
+        for (s = 0; s < sample_count; s++)
+        {
+            int n;
+            operations = 0;
+            start = osGetMicroseconds();
+            for (n = 0; n < iterations; n++)
+                operations += bench->run();
+            elapsed = osGetMicroseconds() - start;
+            samples[s] = elapsed * 1000.0 / operations;
+        }
+
+        qsort(samples, sample_count, sizeof(double), compare);
+        median = samples[sample_count / 2];
+        for (s = 0; s < sample_count; s++)
+            samples[s] = fabs(samples[s] - median);
+        qsort(samples, sample_count, sizeof(double), compare);
+        mad = samples[sample_count / 2];
+
+        if (format == ECsv)
+            printf("%s,%.3f,%.3f,%d,%d,%u\n", bench->name, median, mad, sample_count, iterations, base_seed);
+        else if (format == EJson)
+            printf("%s\n  {\"name\":\"%s\",\"median_ns\":%.3f,\"mad_ns\":%.3f,\"samples\":%d,\"iterations\":%d,\"seed\":%u}",
+                reported ? "," : "", bench->name, median, mad, sample_count, iterations, base_seed);
+        else
+            printf("%-20s %12.1f %12.1f %10d\n", bench->name, median, mad, iterations);
+        reported++;
+    }
+
+    if (format == EJson)
+        printf("\n]\n");
+
+    free(samples);
+    free(buffer);
+    return 0;
+}
+
+// game.c links against the renderer, but no benchmark draws a frame.
+void osPresent(const unsigned char *rgba, int width, int height)
+{
+}
+
+unsigned int osGetMilliseconds()
+{
+    return (unsigned int) (osGetMicroseconds() / 1000);
+}
+
+unsigned long long osGetMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// xorshift32 keeps the inputs identical across platforms, unlike rand().
+static unsigned int next_random()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void random_board(TileRow *board)
+{
+    int height = 4 + next_random() % (ROW_COUNT - 4);
+    int row, col;
+
+    memset(board, 0, sizeof(TileRow) * ROW_COUNT);
+    for (row = ROW_COUNT - height; row < ROW_COUNT; row++)
+    {
+        int full = next_random() % 4 == 0;
+        for (col = 0; col < COL_COUNT; col++)
+        {
+            if (full || next_random() % 3)
+                board[row][col] = (unsigned char) ((next_random() % PIECE_COUNT) << 4 | (1 + next_random() % 15));
+        }
+    }
+}
+
+static void setup_pieces()
+{
+    int i;
+    for (i = 0; i < BOARD_SET; i++)
+        random_board(boards[i]);
+    for (i = 0; i < PIECE_SET; i++)
+    {
+        pieces[i].index = next_random() % PIECE_COUNT;
+        pieces[i].rotation = next_random() % 4;
+        pieces[i].col = (int) (next_random() % (COL_COUNT + 2)) - 2;
+        pieces[i].row = (float) (next_random() % (ROW_COUNT * 4)) / 4.0f - 3.0f;
+    }
+}
+
+static void setup_games()
+{
+    int i;
+    memset(games, 0, sizeof(games));
+    for (i = 0; i < BOARD_SET; i++)
+    {
+        random_board(games[i].board);
+        memcpy(boards[i], games[i].board, sizeof(games[i].board));
+        check_completions(games + i);
+    }
+}
+
+static void setup_buffer()
+{
+}
+
+// Random DXT5 blocks in the same 6-bit text encoding as the compiled-in assets.
+static void setup_dxt5()
+{
+    int size = DXT5_SIZE;
+    int strings = 0;
+    int i, j, shift = 0;
+    unsigned char prev = 0;
+    char *p = dxt5_text;
+
+    for (i = 0; i < size; i++)
+        buffer[i] = (unsigned char) next_random();
+
+    dxt5_strings[strings++] = p;
+    for (i = 0, j = 0; i < size; i++)
+    {
+        unsigned char i8 = buffer[i];
+        shift += 2;
+        *p++ = (char) ('0' + (((prev << (8 - shift)) | (i8 >> shift)) & 0x3f));
+        if (shift == 6)
+        {
+            *p++ = (char) ('0' + (i8 & 0x3f));
+            shift = 0;
+            j += 2;
+        }
+        else
+        {
+            j++;
+        }
+        prev = i8;
+        if (j >= 128)
+        {
+            *p++ = 0;
+            dxt5_strings[strings++] = p;
+            j = 0;
+        }
+    }
+    *p = 0;
+}
+
+static void setup_text()
+{
+    const Kerning *k = fonts[EVera].pairs;
+    int pairs = 0, i;
+
+    if (!fonts[EVera].indexed)
+        font_create(fonts + EVera);
+
+    while (k[pairs].first)
+        pairs++;
+
+    // Half the characters come from real kerning pairs so both hit and miss paths are timed.
+    for (i = 0; i + 1 < TEXT_SIZE; i += 2)
+    {
+        if (next_random() % 2)
+        {
+            const Kerning *pair = k + next_random() % pairs;
+            text[i] = (char) pair->first;
+            text[i + 1] = (char) pair->second;
+        }
+        else
+        {
+            text[i] = (char) (' ' + next_random() % 95);
+            text[i + 1] = (char) (' ' + next_random() % 95);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int run_collide()
+{
+    int i, hits = 0;
+    for (i = 0; i < PIECE_SET; i++)
+        hits += collide(pieces + i, boards[i & (BOARD_SET - 1)]);
+    sink = hits;
+    return PIECE_SET;
+}
+
+static int run_lock_piece()
+{
+    TileRow board[ROW_COUNT];
+    int i;
+    for (i = 0; i < PIECE_SET; i++)
+    {
+        if (!(i & (BOARD_SET - 1)))
+            memcpy(board, boards[i & (BOARD_SET - 1)], sizeof(board));
+        lock_piece(pieces + i, board);
+    }
+    sink = board[ROW_COUNT - 1][0];
+    return PIECE_SET;
+}
+
+static int run_check_completions()
+{
+    int i, count = 0;
+    for (i = 0; i < BOARD_SET; i++)
+        count += check_completions(games + i);
+    sink = count;
+    return BOARD_SET;
+}
+
+static int run_nuke_lines()
+{
+    int i;
+    for (i = 0; i < BOARD_SET; i++)
+    {
+        memcpy(games[i].board, boards[i], sizeof(games[i].board));
+        nuke_lines(games + i);
+    }
+    sink = games[0].board[ROW_COUNT - 1][0];
+    return BOARD_SET;
+}
+
+static int run_decode_tiles()
+{
+    int i, written = 0;
+    for (i = 0; i < TILE_COUNT; i++)
+        written += decode(buffer, assets->tiles[i]);
+    sink = written;
+    return TILE_COUNT;
+}
+
+static int run_decode_backdrop()
+{
+    sink = decode(buffer, assets->backdrops[0]);
+    return 1;
+}
+
+static int run_decode_dxt1()
+{
+    decode_dxt1(BACKDROP_WIDTH, BACKDROP_HEIGHT, buffer, assets->backdrops[0]);
+    sink = buffer[0];
+    return 1;
+}
+
+static int run_decode_dxt5()
+{
+    decode_dxt5(BACKDROP_WIDTH, BACKDROP_HEIGHT, buffer, dxt5_strings);
+    sink = buffer[0];
+    return 1;
+}
+
+static int run_font_glyph()
+{
+    const FontInfo *info = fonts + EVera;
+    int i, width = 0;
+    for (i = 0; i < TEXT_SIZE; i++)
+    {
+        const Glyph *glyph = font_glyph(info, text[i]);
+        if (glyph)
+            width += glyph->xadvance;
+    }
+    sink = width;
+    return TEXT_SIZE;
+}
+
+static int run_font_kerning()
+{
+    const FontInfo *info = fonts + EVera;
+    int i, amount = 0;
+    for (i = 1; i < TEXT_SIZE; i++)
+        amount += font_kerning(info, text[i - 1], text[i]);
+    sink = amount;
+    return TEXT_SIZE - 1;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,516 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// Render regression check.  Plays scripted sessions headlessly through os.egl.c,
+// compares chosen frames against stored golden images, and times every frame, so that
+// renderer changes can be checked for both pixels and speed.  'make check' runs it.
+//
+// Usage: tetrita-check [-update] [-dirty] [-golden dir] [-threshold N] [-pixels N]
+//                      [-times file] [-baseline file] [-slack percent] manifest
+//
+// The manifest lists one checkpoint per line: a name, a session recorded with
+// 'tetrita -record' (or written by hand), the frame to capture and the state the game
+// must be in at that frame.  Sessions are found relative to the manifest, and golden
+// images are binary PPMs named after their checkpoints in the 'golden' directory beside
+// it, or in the -golden directory.  The backends round differently, so each keeps its
+// own set; 'make check' picks tests/golden/$(DRAW).
+//
+//     # name      session        frame  state
+//     intro       play.replay    25     EIntro
+//
+// Sessions replay as in tetrita-export, except that the game keeps drawing while
+// paused, so a hand-written session can hold a pause for a few frames.
+//
+// A pixel matches when no channel differs from the golden image by more than the
+// threshold, and a frame passes when at most the given number of pixels don't match.
+// The defaults suit Mesa's llvmpipe, which the golden images come from; other drivers
+// will want something looser, like '-threshold 8 -pixels 500'.
+// Failing frames are written to <name>.actual.ppm along with <name>.diff.ppm, which
+// marks the mismatches in red.  -update rewrites the golden images instead.
+//
+// Each session's frame times (game_draw through osSwapBuffers, which waits for the
+// GPU) are summarized on stdout, followed in PROFILE builds by the profiler's last few
+// hundred frames, which include each pass's GPU time.  -times writes every sample to a
+// CSV file, and -baseline reads a file written that way and fails any session whose
+// median frame time grew by more than the slack, 25% unless given.
+
+#include "os.h"
+#include "game.h"
+#include "draw.h"
+#include "replay.h"
+#include "profile.h"
+#include "GL/gl.h"
+
+#define CHECKPOINT_CAPACITY 64
+#define PATH_CAPACITY       256
+#define DEFAULT_THRESHOLD   2
+#define DEFAULT_SLACK       25
+
+typedef struct
+{
+    char name[64];
+    char session[PATH_CAPACITY];
+    unsigned int frame;
+    GameState state;
+    int reached;
+    int passed;
+} Checkpoint;
+
+typedef struct
+{
+    char session[PATH_CAPACITY];
+    unsigned int *samples;
+    int count;
+    int capacity;
+} Timing;
+
+static const struct
+{
+    const char *name;
+    GameState state;
+} state_names[] =
+{
+    { "EIntro",      EIntro },
+    { "EStartQuery", EStartQuery },
+    { "EPlay",       EPlay },
+    { "EPaused",     EPaused },
+    { "ECompleting", ECompleting },
+    { "ESlamming",   ESlamming },
+    { "ESettle",     ESettle },
+    { "ELocking",    ELocking },
+    { "EEndQuery",   EEndQuery },
+};
+
+#define STATE_COUNT (sizeof(state_names) / sizeof(state_names[0]))
+
+static struct
+{
+    char directory[PATH_CAPACITY];
+    const char *golden_directory;
+    Checkpoint checkpoints[CHECKPOINT_CAPACITY];
+    int count;
+    int update;
+    int threshold;
+    int pixels;
+    unsigned char rgba[4 * BASE_WIDTH * BASE_HEIGHT];
+    unsigned char rgb[3 * BASE_WIDTH * BASE_HEIGHT];
+    unsigned char golden[3 * BASE_WIDTH * BASE_HEIGHT];
+} check;
+
+static void load_manifest(const char *filename);
+static void run_session(const char *session, Timing *timing);
+static int compare_frame(Checkpoint *checkpoint);
+static int read_ppm(const char *filename, unsigned char *rgb);
+static int write_ppm(const char *filename, const unsigned char *rgb);
+static unsigned int median(Timing *timing);
+static void report(const Timing *timing);
+static int load_baseline(const char *filename, const char *session, Timing *timing);
+static const char *state_name(GameState state);
+static int compare(const void *a, const void *b);
+static void usage();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    const char *manifest = 0;
+    const char *times = 0;
+    const char *baseline = 0;
+    int slack = DEFAULT_SLACK;
+    int failures = 0;
+    FILE *csv = 0;
+    int i, j, k;
+
+    check.threshold = DEFAULT_THRESHOLD;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-update"))
+            check.update = 1;
+        else if (!strcmp(argv[i], "-dirty"))
+            draw_partial(1);
+        else if (!strcmp(argv[i], "-golden") && i + 1 < argc)
+            check.golden_directory = argv[++i];
+        else if (!strcmp(argv[i], "-threshold") && i + 1 < argc)
+            check.threshold = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-pixels") && i + 1 < argc)
+            check.pixels = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-times") && i + 1 < argc)
+            times = argv[++i];
+        else if (!strcmp(argv[i], "-baseline") && i + 1 < argc)
+            baseline = argv[++i];
+        else if (!strcmp(argv[i], "-slack") && i + 1 < argc)
+            slack = atoi(argv[++i]);
+        else if (argv[i][0] == '-' || manifest)
+            usage();
+        else
+            manifest = argv[i];
+    }
+    if (!manifest)
+        usage();
+
+    load_manifest(manifest);
+    if (times && !(csv = fopen(times, "w")))
+        fatalf("Error: couldn't write %s\n", times);
+    if (csv)
+        fprintf(csv, "session,frame,usec\n");
+
+#ifdef CORE_PROFILE
+    osInit("Tetrita", VIEW_WIDTH, VIEW_HEIGHT, OS_CORE, 0);
+#else
+    osInit("Tetrita", VIEW_WIDTH, VIEW_HEIGHT, 0, 0);
+#endif
+
+    // Each session runs once, capturing all of its checkpoints.
+    for (i = 0; i < check.count; i++)
+    {
+        const char *session = check.checkpoints[i].session;
+        Timing timing;
+
+        for (j = 0; j < i && strcmp(check.checkpoints[j].session, session); j++);
+        if (j < i)
+            continue;
+
+        memset(&timing, 0, sizeof(timing));
+        strcpy(timing.session, session);
+        run_session(session, &timing);
+        report(&timing);
+#ifdef PROFILE
+        {
+            char phases[1024];
+            profile_report(phases, sizeof(phases));
+            printf("%s", phases);
+        }
+#endif
+
+        if (csv)
+        {
+            for (k = 0; k < timing.count; k++)
+                fprintf(csv, "%s,%d,%u\n", session, k, timing.samples[k]);
+        }
+
+        if (baseline)
+        {
+            Timing previous;
+            memset(&previous, 0, sizeof(previous));
+            if (load_baseline(baseline, session, &previous))
+            {
+                unsigned int before = median(&previous);
+                unsigned int after = median(&timing);
+                if (after * 100.0 > before * (100.0 + slack))
+                {
+                    printf("FAIL %s: median frame went from %u to %u usec\n", session, before, after);
+                    failures++;
+                }
+            }
+            free(previous.samples);
+        }
+        free(timing.samples);
+    }
+
+    for (i = 0; i < check.count; i++)
+        failures += !check.checkpoints[i].passed;
+
+    if (csv)
+        fclose(csv);
+    osQuit();
+
+    printf("%s: %d checkpoints, %d failures\n", failures ? "FAILED" : "passed", check.count, failures);
+    return failures ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void load_manifest(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    const char *slash = strrchr(filename, '/');
+    char line[512], state[32];
+    int number = 0;
+
+    if (!file)
+        fatalf("Error: couldn't read %s\n", filename);
+
+    if (slash)
+        sprintf(check.directory, "%.*s/", (int) (slash - filename), filename);
+
+    while (fgets(line, sizeof(line), file))
+    {
+        Checkpoint *checkpoint = check.checkpoints + check.count;
+        char session[PATH_CAPACITY];
+        unsigned int s;
+        int fields;
+
+        number++;
+        fields = sscanf(line, " %63s %200s %u %31s", checkpoint->name, session, &checkpoint->frame, state);
+        if (fields <= 0 || checkpoint->name[0] == '#')
+            continue;
+        if (fields != 4)
+            fatalf("Error: %s:%d: expected a name, session, frame and state\n", filename, number);
+        if (check.count == CHECKPOINT_CAPACITY)
+            fatalf("Error: %s:%d: too many checkpoints\n", filename, number);
+
+        for (s = 0; s < STATE_COUNT && strcmp(state_names[s].name, state); s++);
+        if (s == STATE_COUNT)
+            fatalf("Error: %s:%d: unknown state %s\n", filename, number, state);
+
+        sprintf(checkpoint->session, "%s%s", check.directory, session);
+        checkpoint->state = state_names[s].state;
+        check.count++;
+    }
+    fclose(file);
+}
+
+static void run_session(const char *session, Timing *timing)
+{
+    Replay *replay = replay_load(session);
+    Game *game;
+    unsigned int frame;
+    int event, i;
+
+    if (!replay)
+        fatalf("Error: couldn't read %s\n", session);
+
+    srand(replay->seed);
+    game = game_create();
+    for (frame = 0, event = 0; frame < replay->frames; frame++)
+    {
+        unsigned long long start;
+
+        for (; event < replay->count && replay->events[event].frame == frame; event++)
+        {
+            if (replay->events[event].pressed)
+                game_press(game, replay->events[event].button);
+            else
+                game_release(game, replay->events[event].button);
+        }
+
+        if (game_state(game) == EDone)
+            break;
+        if (game_state(game) != EPaused)
+            game_update(game);
+
+        start = osGetMicroseconds();
+        game_draw(game);
+        osSwapBuffers();
+        if (timing->count == timing->capacity)
+        {
+            timing->capacity = max(1024, 2 * timing->capacity);
+            timing->samples = (unsigned int *) realloc(timing->samples, timing->capacity * sizeof(unsigned int));
+        }
+        timing->samples[timing->count++] = (unsigned int) (osGetMicroseconds() - start);
+        PROFILE_FRAME();
+
+        for (i = 0; i < check.count; i++)
+        {
+            Checkpoint *checkpoint = check.checkpoints + i;
+            if (checkpoint->frame != frame || strcmp(checkpoint->session, session))
+                continue;
+
+            checkpoint->reached = 1;
+            if (game_state(game) != checkpoint->state)
+            {
+                printf("FAIL %s: expected %s at frame %u but the game is in %s\n",
+                    checkpoint->name, state_name(checkpoint->state), frame, state_name(game_state(game)));
+                continue;
+            }
+
+            glReadPixels(0, 0, VIEW_WIDTH, VIEW_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, check.rgba);
+            checkpoint->passed = compare_frame(checkpoint);
+        }
+    }
+
+    game_destroy(game);
+    replay_close(replay, 0);
+
+    for (i = 0; i < check.count; i++)
+    {
+        Checkpoint *checkpoint = check.checkpoints + i;
+        if (!strcmp(checkpoint->session, session) && !checkpoint->reached)
+            printf("FAIL %s: the session ended at frame %u\n", checkpoint->name, frame);
+    }
+}
+
+// Flips the capture to top-down RGB, then either replaces the golden image or counts
+// the pixels that differ from it.
+static int compare_frame(Checkpoint *checkpoint)
+{
+    char filename[PATH_CAPACITY + 80];
+    int x, y, mismatches = 0, worst = 0;
+
+    for (y = 0; y < VIEW_HEIGHT; y++)
+    {
+        const unsigned char *src = check.rgba + 4 * (VIEW_HEIGHT - 1 - y) * VIEW_WIDTH;
+        unsigned char *dest = check.rgb + 3 * y * VIEW_WIDTH;
+        for (x = 0; x < VIEW_WIDTH; x++, src += 4, dest += 3)
+        {
+            dest[0] = src[0];
+            dest[1] = src[1];
+            dest[2] = src[2];
+        }
+    }
+
+    if (check.golden_directory)
+        sprintf(filename, "%s/%s.ppm", check.golden_directory, checkpoint->name);
+    else
+        sprintf(filename, "%sgolden/%s.ppm", check.directory, checkpoint->name);
+    if (check.update)
+    {
+        if (!write_ppm(filename, check.rgb))
+            fatalf("Error: couldn't write %s\n", filename);
+        printf("wrote %s\n", filename);
+        return 1;
+    }
+
+    if (!read_ppm(filename, check.golden))
+    {
+        printf("FAIL %s: couldn't read %s\n", checkpoint->name, filename);
+        return 0;
+    }
+
+    for (x = 0; x < 3 * VIEW_WIDTH * VIEW_HEIGHT; x += 3)
+    {
+        int difference = 0, c;
+        for (c = 0; c < 3; c++)
+            difference = max(difference, abs(check.rgb[x + c] - check.golden[x + c]));
+        worst = max(worst, difference);
+        if (difference > check.threshold)
+        {
+            mismatches++;
+            check.golden[x + 0] = 255;
+            check.golden[x + 1] = 0;
+            check.golden[x + 2] = 0;
+        }
+        else
+        {
+            check.golden[x + 0] = check.golden[x + 1] = check.golden[x + 2] = (unsigned char) (check.rgb[x + 1] / 3);
+        }
+    }
+
+    if (mismatches <= check.pixels)
+    {
+        printf("pass %s: %d pixels differ, by at most %d\n", checkpoint->name, mismatches, worst);
+        return 1;
+    }
+
+    printf("FAIL %s: %d pixels differ, by at most %d\n", checkpoint->name, mismatches, worst);
+    sprintf(filename, "%s.actual.ppm", checkpoint->name);
+    write_ppm(filename, check.rgb);
+    sprintf(filename, "%s.diff.ppm", checkpoint->name);
+    write_ppm(filename, check.golden);
+    return 0;
+}
+
+static int read_ppm(const char *filename, unsigned char *rgb)
+{
+    FILE *file = fopen(filename, "rb");
+    int width, height, depth, ok;
+
+    if (!file)
+        return 0;
+
+    ok = fscanf(file, "P6 %d %d %d", &width, &height, &depth) == 3 &&
+        width == VIEW_WIDTH && height == VIEW_HEIGHT && depth == 255 &&
+        fgetc(file) != EOF &&
+        fread(rgb, 3 * width, height, file) == (size_t) height;
+    fclose(file);
+    return ok;
+}
+
+static int write_ppm(const char *filename, const unsigned char *rgb)
+{
+    FILE *file = fopen(filename, "wb");
+    int ok;
+
+    if (!file)
+        return 0;
+
+    fprintf(file, "P6\n%d %d\n255\n", VIEW_WIDTH, VIEW_HEIGHT);
+    ok = fwrite(rgb, 3 * VIEW_WIDTH, VIEW_HEIGHT, file) == VIEW_HEIGHT;
+    fclose(file);
+    return ok;
+}
+
+static unsigned int median(Timing *timing)
+{
+    if (!timing->count)
+        return 0;
+    qsort(timing->samples, timing->count, sizeof(unsigned int), compare);
+    return timing->samples[timing->count / 2];
+}
+
+static void report(const Timing *timing)
+{
+    unsigned int *sorted;
+    unsigned long long total = 0;
+    int i;
+
+    if (!timing->count)
+        return;
+
+    sorted = (unsigned int *) malloc(timing->count * sizeof(unsigned int));
+    memcpy(sorted, timing->samples, timing->count * sizeof(unsigned int));
+    qsort(sorted, timing->count, sizeof(unsigned int), compare);
+    for (i = 0; i < timing->count; i++)
+        total += sorted[i];
+
+    printf("time %s: %d frames, mean %.0f, median %u, p95 %u, max %u usec\n",
+        timing->session,
+        timing->count,
+        (double) total / timing->count,
+        sorted[timing->count / 2],
+        sorted[timing->count * 95 / 100],
+        sorted[timing->count - 1]);
+    free(sorted);
+}
+
+// Collects the samples for one session from a file written with -times.
+static int load_baseline(const char *filename, const char *session, Timing *timing)
+{
+    FILE *file = fopen(filename, "r");
+    char line[PATH_CAPACITY + 64];
+    size_t length = strlen(session);
+
+    if (!file)
+        fatalf("Error: couldn't read %s\n", filename);
+
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned int frame, usec;
+        if (strncmp(line, session, length) || line[length] != ',')
+            continue;
+        if (sscanf(line + length, ",%u,%u", &frame, &usec) != 2)
+            continue;
+        if (timing->count == timing->capacity)
+        {
+            timing->capacity = max(1024, 2 * timing->capacity);
+            timing->samples = (unsigned int *) realloc(timing->samples, timing->capacity * sizeof(unsigned int));
+        }
+        timing->samples[timing->count++] = usec;
+    }
+    fclose(file);
+    return timing->count > 0;
+}
+
+static const char *state_name(GameState state)
+{
+    unsigned int s;
+    for (s = 0; s < STATE_COUNT; s++)
+    {
+        if (state_names[s].state == state)
+            return state_names[s].name;
+    }
+    return "EDone";
+}
+
+static int compare(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return (x > y) - (x < y);
+}
+
+static void usage()
+{
+    fatalf("Usage: tetrita-check [-update] [-dirty] [-golden dir] [-threshold N] [-pixels N]\n"
+           "                     [-times file] [-baseline file] [-slack percent] manifest\n");
+}
@@ -6,22 +6,62 @@
 #include "images/philip.c"
 #include "images/vera.c"
 
-#if VIEW_SCALE > 1
-#include "images/tile.big.c"
-#include "images/title.dxt5.big.c"
-#include "images/basil1.dxt1.big.c"
-#include "images/basil2.dxt1.big.c"
-#include "images/basil3.dxt1.big.c"
-#include "images/basil4.dxt1.big.c"
-#else
+
+#define TILE_STRINGS 6
 #include "images/tile.small.c"
 #include "images/title.dxt5.small.c"
 #include "images/basil1.dxt1.small.c"
 #include "images/basil2.dxt1.small.c"
 #include "images/basil3.dxt1.small.c"
 #include "images/basil4.dxt1.small.c"
+#undef TILE_STRINGS
+
+// Both tiers' image files use the same names, so the big ones are renamed as they're included.
+#ifdef BIG_ASSETS
+#define TILE_STRINGS 20
+#define tile_images tile_images_big
+#define title_image title_image_big
+#define basil1_image basil1_image_big
+#define basil2_image basil2_image_big
+#define basil3_image basil3_image_big
+#define basil4_image basil4_image_big
+#include "images/tile.big.c"
+#include "images/title.dxt5.big.c"
+#include "images/basil1.dxt1.big.c"
+#include "images/basil2.dxt1.big.c"
+#include "images/basil3.dxt1.big.c"
+#include "images/basil4.dxt1.big.c"
+#undef TILE_STRINGS
+#undef tile_images
+#undef title_image
+#undef basil1_image
+#undef basil2_image
+#undef basil3_image
+#undef basil4_image
 #endif
 
+int view_scale = 1;
+
+const AssetTier asset_tiers[ASSET_TIER_COUNT] =
+{
+    {
+        1, 480, 320, 15, 16, 128, 107, 27, 0,
+        { tile_images[0], tile_images[1], tile_images[2], tile_images[3], tile_images[4] },
+        title_image,
+        { basil1_image, basil2_image, basil3_image, basil4_image },
+    },
+#ifdef BIG_ASSETS
+    {
+        2, 960, 640, 30, 32, 256, 212, 52, 1,
+        { tile_images_big[0], tile_images_big[1], tile_images_big[2], tile_images_big[3], tile_images_big[4] },
+        title_image_big,
+        { basil1_image_big, basil2_image_big, basil3_image_big, basil4_image_big },
+    },
+#endif
+};
+
+const AssetTier *assets = asset_tiers;
+
 #undef RGB
 #undef RGBA
 
@@ -69,8 +109,9 @@ const unsigned short patterns[PIECE_COUNT * 4][4] =
     { 0x0000, 0x0000, 0xb400, 0x05c0 }, { 0x0000, 0x00d0, 0x0360, 0x0e00 }, { 0x0000, 0x0000, 0xb400, 0x05c0 }, { 0x0000, 0x00d0, 0x0360, 0x0e00 },
 };
 
-#define TL(s, t) ((float) s * TILE_POT_SIZE / TILEBANK_WIDTH), ((float) t * TILE_SIZE / TILEBANK_HEIGHT)
-#define TR(s, t) ((float) s * TILE_POT_SIZE / TILEBANK_WIDTH + (float) TILE_SIZE / TILEBANK_WIDTH), ((float) t * TILE_SIZE / TILEBANK_HEIGHT)
+// In the small tier's pixels; every tier lays out its tile bank in the same proportions.
+#define TL(s, t) ((float) s * 16 / 128), ((float) t * 15 / 16)
+#define TR(s, t) ((float) s * 16 / 128 + (float) 15 / 128), ((float) t * 15 / 16)
 
 const float tile_coords[16][4][2] =
 {
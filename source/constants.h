@@ -4,9 +4,15 @@
 #pragma once
 #include "font.h"
 
-#define VIEW_SCALE   1
-#define VIEW_WIDTH   (480 * VIEW_SCALE)
-#define VIEW_HEIGHT  (320 * VIEW_SCALE)
+// Drawing is in view units, BASE_WIDTH by BASE_HEIGHT, and the framebuffer has
+// VIEW_SCALE pixels per unit; the scale is chosen at startup and on resize.
+extern int view_scale;
+
+#define BASE_WIDTH   480
+#define BASE_HEIGHT  320
+#define VIEW_SCALE   view_scale
+#define VIEW_WIDTH   (BASE_WIDTH * VIEW_SCALE)
+#define VIEW_HEIGHT  (BASE_HEIGHT * VIEW_SCALE)
 #define PIECE_COUNT  7
 #define ROW_COUNT    20
 #define COL_COUNT    10
@@ -24,14 +30,6 @@
 #define DURATION     10
 #define START_STATE  EIntro
 
-#if VIEW_SCALE > 1
-#define BACKDROP_WIDTH 960
-#define BACKDROP_HEIGHT 640
-#else
-#define BACKDROP_WIDTH 480
-#define BACKDROP_HEIGHT 320
-#endif
-
 #define GRADIENT_BOTTOM PIECE_COUNT + 0
 #define GRADIENT_TOP    PIECE_COUNT + 1
 
@@ -40,38 +38,48 @@ extern const float hi_colors[PIECE_COUNT][3];
 extern const unsigned short patterns[PIECE_COUNT * 4][4];
 extern const float tile_coords[16][4][2];
 
-#if VIEW_SCALE > 1
-#define TILE_STRINGS 20
-#define TILE_SIZE 30
-#define TILE_POT_SIZE 32
-#define TILEBANK_WIDTH 256
-#define TITLE_WIDTH 212
-#define TITLE_HEIGHT 52
-#else
-#define TILE_STRINGS 6
-#define TILE_SIZE 15
-#define TILE_POT_SIZE 16
-#define TILEBANK_WIDTH 128
-#define TITLE_WIDTH 107
-#define TITLE_HEIGHT 27
-#endif
-
 #define TILE_COUNT 5
-#define TILEBANK_HEIGHT TILE_POT_SIZE
 #define PHILIP_WIDTH 154
 #define PHILIP_HEIGHT 19
 
-extern const char *tile_images[TILE_COUNT][TILE_STRINGS];
-extern const char *title_image[];
 extern const char *philip_image[];
 
 #define BASIL_COUNT 4
 #define BASIL_INDEX(a) ((a / 2) >= BASIL_COUNT ? (BASIL_COUNT - 1) : (a / 2))
 
-extern const char *basil1_image[];
-extern const char *basil2_image[];
-extern const char *basil3_image[];
-extern const char *basil4_image[];
+// The tiles, title and backdrops come in tiers of pixel density, with ASSET_SCALE
+// pixels per view unit.  draw_create decodes the one tier that suits the render scale;
+// the big tier is only linked into 'make BIG_ASSETS=1' builds.
+typedef struct AssetTierRec
+{
+    int scale;
+    int backdrop_width, backdrop_height;
+    int tile_size, tile_pot_size, tilebank_width;
+    int title_width, title_height;
+    int title_compressed;
+    const char **tiles[TILE_COUNT];
+    const char **title;
+    const char **backdrops[BASIL_COUNT];
+} AssetTier;
+
+#ifdef BIG_ASSETS
+#define ASSET_TIER_COUNT 2
+#else
+#define ASSET_TIER_COUNT 1
+#endif
+
+extern const AssetTier asset_tiers[ASSET_TIER_COUNT];
+extern const AssetTier *assets;
+
+#define ASSET_SCALE     (assets->scale)
+#define BACKDROP_WIDTH  (assets->backdrop_width)
+#define BACKDROP_HEIGHT (assets->backdrop_height)
+#define TILE_SIZE       (assets->tile_size)
+#define TILE_POT_SIZE   (assets->tile_pot_size)
+#define TILEBANK_WIDTH  (assets->tilebank_width)
+#define TILEBANK_HEIGHT TILE_POT_SIZE
+#define TITLE_WIDTH     (assets->title_width)
+#define TITLE_HEIGHT    (assets->title_height)
 
 #define FONT_COUNT 2
 
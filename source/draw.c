@@ -0,0 +1,1338 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "draw.h"
+#include "image.h"
+#include "profile.h"
+#include "drawlist.h"
+#include "backend.h"
+#include "loader.h"
+
+#define LAYOUT_CACHE_SIZE 8
+#define DAMAGE_HISTORY 4
+
+// The atlas grows downwards in shelves; this is widened if any image is wider.
+#define ATLAS_WIDTH 512
+
+// The tile bank must come first; see pack_atlas.
+typedef enum
+{
+    EAtlasTiles,
+    EAtlasTitle,
+    EAtlasPhilip,
+    EAtlasFonts,
+} AtlasEntry;
+
+#define ATLAS_COUNT (EAtlasFonts + FONT_COUNT)
+
+// Where each image goes in draw_create's list of loads.  The backdrops come first, so a
+// backdrop's load has its index.
+#define ASSET_BACKDROPS 0
+#define ASSET_TILES     (ASSET_BACKDROPS + BASIL_COUNT)
+#define ASSET_TITLE     (ASSET_TILES + TILE_COUNT)
+#define ASSET_PHILIP    (ASSET_TITLE + 1)
+#define ASSET_FONTS     (ASSET_PHILIP + 1)
+#define ASSET_COUNT     (ASSET_FONTS + FONT_COUNT)
+
+// Origin of an image within the atlas, in texture coordinates.
+typedef struct
+{
+    float s, t;
+} Region;
+
+struct GraphicsRec
+{
+    unsigned int backdrops[BASIL_COUNT];
+    unsigned int atlas;
+    Region regions[ATLAS_COUNT];
+    float texel[2];
+};
+
+typedef struct
+{
+    int width, height;
+    int x, y;
+    unsigned char *rgba;
+} AtlasImage;
+
+// An image for the loader to decode, on any thread.  Backdrops are decoded into pixels
+// for backend_backdrop, and the rest into their atlas images.
+typedef struct
+{
+    LoaderJob load;
+    const char **source;
+    int index;
+    AtlasImage *image;
+    unsigned char *pixels;
+} Asset;
+
+// The draw_* functions only record into the list, using the current state and color;
+// draw_flush sorts it and hands it to whichever backend was linked in.  Profiling builds
+// tag the state with the pass being drawn, which the GL backends time on the GPU.
+static struct
+{
+    DrawList list;
+    DrawState state;
+    float color[4];
+} current;
+
+// tile_coords remapped into the atlas.
+static float tile_uvs[16][4][2];
+
+// Laid-out text, keyed by everything that affects its quads.  The HUD and the help
+// box rarely change, so most frames draw them straight from the buffer object.
+typedef struct
+{
+    char *text;
+    Font font;
+    int box[4];
+    float color[4];
+    Vertex *vertices;
+    int count;
+    int capacity;
+    int valid;
+    unsigned int used;
+    unsigned int vbo;
+} Layout;
+
+static struct
+{
+    Layout entries[LAYOUT_CACHE_SIZE];
+    unsigned int clock;
+} layouts;
+
+// The backdrop, title, logo and backboard stop animating once the intro is over, and
+// then only change with the level; they are composited once and blitted from then on.
+static struct
+{
+    unsigned int texture;
+    int level;
+    int valid;
+} layer;
+
+// With partial redraws enabled, each frame is compared against the last, and the
+// backend repaints only what changed.  A swap chain hands back buffers that are a few
+// frames old, so the rects of recent frames are kept to bring them up to date.
+static struct
+{
+    DrawDamage grid;
+    DrawRect history[DAMAGE_HISTORY][DRAW_DAMAGE_CAPACITY];
+    int counts[DAMAGE_HISTORY];
+    int frames;
+    int enabled;
+} damage;
+
+// Locked tiles only change when the game bumps the board generation.  Each row's
+// tiles start at rows[row], which is where the completion flash finds them.
+static struct
+{
+    Vertex vertices[4 * ROW_COUNT * COL_COUNT];
+    int rows[ROW_COUNT + 1];
+    int count;
+    int valid;
+    unsigned int generation;
+    unsigned int vbo;
+} board_cache;
+
+// Where the next-piece preview puts each piece, in tiles.
+static const struct
+{
+    int rotation;
+    float row;
+    int col;
+    int ox;
+    float oy;
+}
+previews[PIECE_COUNT] =
+{
+    0, 15, -15, 1, 1,
+    0, 12, -18, 1, 1.5,
+    0, 11, -16, 2, 2.5,
+    0, 12, -16, 2, 1,
+    1, 12, -15, 1, 1.5,
+    1, 15, -17, 2, 1.5,
+    1, 16, -15, 2, 1.5,
+};
+
+// Geometry for everything the falling piece and the preview animate, built once: each
+// pattern at the top left of the board, each preview where it rests, and a tile-high
+// streak under each column of each pattern for the slam blur.  Animation frames only
+// pick a transform and a color for it.
+// Each pattern, streak set and preview has at most four quads.
+#define PIECE_SHAPES (2 * PIECE_COUNT * 4 + PIECE_COUNT)
+
+typedef struct
+{
+    int first;
+    int count;
+} Span;
+
+static struct
+{
+    Vertex vertices[4 * 4 * PIECE_SHAPES];
+    Span patterns[PIECE_COUNT * 4];
+    Span previews[PIECE_COUNT];
+    Span streaks[PIECE_COUNT * 4][4];
+    unsigned int vbo;
+} pieces;
+
+#ifdef PROFILE
+#define PASS(phase) (current.state.pass = (unsigned char) (phase))
+#else
+#define PASS(phase)
+#endif
+
+static void set_color(float r, float g, float b, float a);
+static Vertex *append(Primitive primitive, int count);
+static void emit_vertex(Vertex *v, float x, float y);
+static Vertex *emit_quad(Vertex *v, float x0, float y0, float x1, float y1, float s0, float t0, float s1, float t1, const float *color);
+static Vertex *emit_tile(Vertex *v, float col, float row, unsigned char type, const float *color);
+static void create_pieces();
+static void draw_resident(const Span *span, const DrawTransform *transform);
+static void move(DrawTransform *transform, float row, float col);
+static void draw_backboard(float mu, int level);
+static void layout_text(Layout *layout, const Graphics *graphics, Font font, const char *text, int start, int top);
+static void layout_text_box(Layout *layout, const Graphics *graphics, Font font, const char *text, int l, int b, int r, int t);
+static Layout *find_layout(Font font, const char *text, const int *box, const float *color);
+static Vertex *reserve_layout(Layout *layout, int count);
+static void upload_layout(Layout *layout);
+static void draw_layout(const Graphics *graphics, const Layout *layout);
+static void load_backdrop(void *asset);
+static void load_tile(void *asset);
+static void load_title(void *asset);
+static void load_philip(void *asset);
+static void load_font(void *asset);
+static void create_atlas(Graphics *graphics, AtlasImage *images);
+static unsigned char *expand(const unsigned char *src, int count, int channels);
+static int pack_atlas(AtlasImage *images, int count, int width);
+static void place_image(unsigned char *pixels, int width, const AtlasImage *image);
+static void blit(unsigned int texture, const float *uv, int x, int y, int w, int h, float scale);
+static void fill(float x, float y, float w, float h);
+static void outline(float x, float y, float w, float h);
+static void widen_damage(int age);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Graphics *draw_create()
+{
+    Graphics *graphics = (Graphics *) malloc(sizeof(Graphics));
+    AtlasImage images[ATLAS_COUNT];
+    Asset loads[ASSET_COUNT];
+    Loader *loader;
+    int i, remaining;
+
+    // The densest tier that the render scale doesn't have to shrink; only it is decoded.
+    for (i = 0; i < ASSET_TIER_COUNT; i++)
+    {
+        if (asset_tiers[i].scale <= VIEW_SCALE)
+            assets = asset_tiers + i;
+    }
+
+    backend_init();
+    drawlist_create(&current.list);
+    memset(&current.state, 0, sizeof(current.state));
+    current.state.blend = 1;
+    board_cache.vbo = backend_buffer();
+    board_cache.valid = 0;
+    memset(&layouts, 0, sizeof(layouts));
+    for (i = 0; i < LAYOUT_CACHE_SIZE; i++)
+        layouts.entries[i].vbo = backend_buffer();
+    layer.texture = backend_texture(npot(VIEW_WIDTH), npot(VIEW_HEIGHT), 0);
+    layer.valid = 0;
+
+    // The backdrops, and the title, author, tiles and fonts for the atlas, are decoded
+    // on the loader's workers.  Each backdrop is uploaded as soon as it's decoded, and
+    // the atlas once the last of its images is.
+    memset(loads, 0, sizeof(loads));
+    for (i = 0; i < BASIL_COUNT; i++)
+    {
+        loads[ASSET_BACKDROPS + i].load = load_backdrop;
+        loads[ASSET_BACKDROPS + i].source = assets->backdrops[i];
+    }
+    for (i = 0; i < TILE_COUNT; i++)
+    {
+        loads[ASSET_TILES + i].load = load_tile;
+        loads[ASSET_TILES + i].source = assets->tiles[i];
+        loads[ASSET_TILES + i].index = i;
+        loads[ASSET_TILES + i].image = images + EAtlasTiles;
+    }
+    loads[ASSET_TITLE].load = load_title;
+    loads[ASSET_TITLE].source = assets->title;
+    loads[ASSET_TITLE].image = images + EAtlasTitle;
+    loads[ASSET_PHILIP].load = load_philip;
+    loads[ASSET_PHILIP].source = philip_image;
+    loads[ASSET_PHILIP].image = images + EAtlasPhilip;
+    for (i = 0; i < FONT_COUNT; i++)
+    {
+        loads[ASSET_FONTS + i].load = load_font;
+        loads[ASSET_FONTS + i].index = i;
+        loads[ASSET_FONTS + i].image = images + EAtlasFonts + i;
+    }
+
+    // The tiles share the bank, each writing its own columns.
+    images[EAtlasTiles].width = TILEBANK_WIDTH;
+    images[EAtlasTiles].height = TILEBANK_HEIGHT;
+    images[EAtlasTiles].rgba = (unsigned char *) calloc(4 * TILEBANK_WIDTH * TILEBANK_HEIGHT, 1);
+
+    loader = loader_create(ASSET_COUNT);
+    for (i = 0; i < ASSET_COUNT; i++)
+        loader_add(loader, loads[i].load, loads + i);
+
+    remaining = ASSET_COUNT - BASIL_COUNT;
+    while ((i = loader_next(loader)) >= 0)
+    {
+        if (i < ASSET_BACKDROPS + BASIL_COUNT)
+        {
+            graphics->backdrops[i] = backend_backdrop(loads[i].pixels);
+            free(loads[i].pixels);
+        }
+        else if (--remaining == 0)
+            create_atlas(graphics, images);
+    }
+    loader_destroy(loader);
+
+    create_pieces();
+
+    return graphics;
+}
+
+void draw_destroy(Graphics *graphics)
+{
+    int x;
+    for (x = 0; x < BASIL_COUNT; x++)
+        backend_delete_texture(graphics->backdrops[x]);
+    backend_delete_texture(graphics->atlas);
+    backend_delete_texture(layer.texture);
+    layer.texture = 0;
+    layer.valid = 0;
+    for (x = 0; x < FONT_COUNT; x++)
+        font_destroy(fonts + x);
+    for (x = 0; x < LAYOUT_CACHE_SIZE; x++)
+    {
+        Layout *layout = layouts.entries + x;
+        backend_delete_buffer(layout->vbo);
+        free(layout->text);
+        free(layout->vertices);
+    }
+    memset(&layouts, 0, sizeof(layouts));
+    backend_delete_buffer(board_cache.vbo);
+    backend_delete_buffer(pieces.vbo);
+    pieces.vbo = 0;
+    drawlist_destroy(&current.list);
+    drawlist_damage_destroy(&damage.grid);
+    board_cache.vbo = 0;
+    board_cache.valid = 0;
+    backend_shutdown();
+    free(graphics);
+}
+
+void draw_background(const Graphics *graphics, float frame, int level)
+{
+    const Region *title = graphics->regions + EAtlasTitle;
+    const Region *philip = graphics->regions + EAtlasPhilip;
+    const float *texel = graphics->texel;
+    float mu;
+    float scale = 1.0f / ASSET_SCALE;
+    float uv[4];
+    int index = BASIL_INDEX(level);
+
+    PROFILE_BEGIN(EPhaseBackground);
+    PASS(EPhaseGpuBackground);
+    drawlist_clear(&current.list);
+
+    // The backdrop is opaque, so it can skip blending.
+    set_color(1, 1, 1, 1);
+    uv[0] = 0;
+    uv[1] = 0;
+    uv[2] = (float) VIEW_WIDTH / npot(VIEW_WIDTH);
+    uv[3] = (float) VIEW_HEIGHT / npot(VIEW_HEIGHT);
+    current.state.blend = 0;
+    if (frame >= 0.75f && layer.valid && layer.level == level)
+    {
+        blit(layer.texture, uv, 0, 0, VIEW_WIDTH, VIEW_HEIGHT, 1.0f / VIEW_SCALE);
+        current.state.blend = 1;
+        PASS(0);
+        PROFILE_END(EPhaseBackground);
+        return;
+    }
+    uv[2] = (float) BACKDROP_WIDTH / npot(BACKDROP_WIDTH);
+    uv[3] = (float) BACKDROP_HEIGHT / npot(BACKDROP_HEIGHT);
+    blit(graphics->backdrops[index], uv, 0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT, scale);
+    current.state.blend = 1;
+
+    mu = clamp(frame / 0.25f);
+    set_color(1, 1, 1, mu);
+    uv[0] = title->s;
+    uv[1] = title->t;
+    uv[2] = title->s + TITLE_WIDTH * texel[0];
+    uv[3] = title->t + TITLE_HEIGHT * texel[1];
+    blit(graphics->atlas, uv, 30, 250, TITLE_WIDTH, TITLE_HEIGHT, scale);
+
+    mu = clamp((frame - 0.25f) / 0.25f);
+    if (index == 3)
+        set_color(1, 1, 1, mu);
+    else
+        set_color(0, 0, 0, mu);
+    uv[0] = philip->s;
+    uv[1] = philip->t;
+    uv[2] = philip->s + PHILIP_WIDTH * texel[0];
+    uv[3] = philip->t + PHILIP_HEIGHT * texel[1];
+    blit(graphics->atlas, uv, 35, 220, PHILIP_WIDTH, PHILIP_HEIGHT, scale);
+
+    mu = clamp((frame - 0.5f) / 0.25f);
+    draw_backboard(mu, level);
+    if (mu >= 1)
+    {
+        drawlist_capture(&current.list, layer.texture);
+        layer.level = level;
+        layer.valid = 1;
+    }
+    PASS(0);
+    PROFILE_END(EPhaseBackground);
+}
+
+void draw_begin_tiles(const Graphics *graphics)
+{
+    PROFILE_BEGIN(EPhaseTiles);
+    PASS(EPhaseGpuTiles);
+    current.state.scissor = 1;
+    current.state.texture = graphics->atlas;
+}
+
+void draw_end_tiles()
+{
+    current.state.scissor = 0;
+    PASS(0);
+    PROFILE_END(EPhaseTiles);
+}
+
+void draw_flush()
+{
+    if (damage.enabled)
+    {
+        if (!damage.grid.cells)
+            drawlist_damage_create(&damage.grid, BASE_WIDTH, BASE_HEIGHT);
+        drawlist_damage(&current.list, &damage.grid);
+        widen_damage(backend_buffer_age());
+    }
+    drawlist_sort(&current.list);
+    backend_submit(&current.list);
+    drawlist_reset(&current.list);
+}
+
+void draw_partial(int enable)
+{
+    damage.enabled = enable;
+    damage.grid.valid = 0;
+}
+
+// The asset tier is picked from the scale in draw_create and kept from then on, so a
+// later change only resizes the view and the targets that match it.
+void draw_scale(int scale)
+{
+    scale = max(scale, 1);
+    if (scale == VIEW_SCALE)
+        return;
+    view_scale = scale;
+    if (!layer.texture)
+        return;
+
+    backend_resize();
+    backend_delete_texture(layer.texture);
+    layer.texture = backend_texture(npot(VIEW_WIDTH), npot(VIEW_HEIGHT), 0);
+    layer.valid = 0;
+    damage.grid.valid = 0;
+}
+
+// Each column's streak is stretched up from its bottom edge.
+void draw_blur(const Piece *piece, int frame)
+{
+    const Span *streaks = pieces.streaks[piece->index * 4 + piece->rotation];
+    DrawTransform transform;
+    int x;
+
+    current.state.scissor = 1;
+    current.state.texture = 0;
+    for (x = 0; x < 4; x++)
+    {
+        if (streaks[x].count)
+        {
+            move(&transform, piece->row, (float) piece->col);
+            transform.y = pieces.vertices[streaks[x].first].y;
+            transform.scale[1] = (float) frame;
+            draw_resident(streaks + x, &transform);
+        }
+    }
+    current.state.scissor = 0;
+}
+
+void draw_guide(const Piece *piece, int level)
+{
+    const float w = TILE_WIDTH;
+    const float h = TILE_HEIGHT;
+    const float yy = BOARD_BOTTOM;
+    const unsigned short *pattern = patterns[piece->index * 4 + piece->rotation];
+    int x;
+    int y;
+
+    PROFILE_BEGIN(EPhaseNext);
+    PASS(EPhaseGpuNext);
+    if (BASIL_INDEX(level) == 2)
+        set_color(1, 1, 1, 1);
+    else
+        set_color(1, 1, 1, 0.7f);
+
+    current.state.texture = 0;
+    for (x = 0; x < 4; x++)
+    {
+        for (y = 0; y < 4; y++)
+        {
+            unsigned short row = pattern[y];
+            row <<= 4 * x;
+            if (row & 0xf000)
+            {
+                float xx = BOARD_LEFT + w * (piece->col + x);
+                Vertex *v = append(EPrimQuads, 4);
+                emit_vertex(v + 0, xx, yy - 0.75f);
+                emit_vertex(v + 1, xx + w, yy - 0.75f);
+                emit_vertex(v + 2, xx + w, yy - GUIDE_WIDTH);
+                emit_vertex(v + 3, xx, yy - GUIDE_WIDTH);
+                break;
+            }
+        }
+    }
+    PASS(0);
+    PROFILE_END(EPhaseNext);
+}
+
+void draw_lock(const Piece *piece, float mu)
+{
+    const float *color = hi_colors[piece->index];
+    const Span *pattern = pieces.patterns + piece->index * 4 + piece->rotation;
+    DrawTransform transform;
+
+    current.state.color = (unsigned char) drawlist_color(&current.list, color[0], color[1], color[2], 1 - mu);
+    move(&transform, piece->row, piece->col - 2 * mu);
+    draw_resident(pattern, &transform);
+    move(&transform, piece->row, piece->col + 2 * mu);
+    draw_resident(pattern, &transform);
+    current.state.color = 0;
+}
+
+void draw_board(const TileRow *board, unsigned int generation)
+{
+    DrawState state = current.state;
+    int row, col;
+
+    if (!board_cache.valid || board_cache.generation != generation)
+    {
+        Vertex *v = board_cache.vertices;
+        board_cache.rows[0] = 0;
+        for (row = 0; row < ROW_COUNT; row++)
+        {
+            for (col = 0; col < COL_COUNT; col++)
+            {
+                unsigned char c = board[row][col];
+                if (c)
+                {
+                    const float *color = colors[c >> 4];
+                    const float opaque[4] = { color[0], color[1], color[2], 1 };
+                    v = emit_tile(v, (float) col, (float) row, c & 0xf, opaque);
+                }
+            }
+            board_cache.rows[row + 1] = (int) (v - board_cache.vertices);
+        }
+        board_cache.count = (int) (v - board_cache.vertices);
+        board_cache.generation = generation;
+        board_cache.valid = 1;
+        backend_upload(board_cache.vbo, board_cache.vertices, board_cache.count);
+    }
+
+    state.primitive = EPrimQuads;
+    drawlist_cached(&current.list, &state, board_cache.vertices, board_cache.vbo, 0, board_cache.count);
+}
+
+// Completed rows are full, so the flash is just their tiles from the board's own
+// geometry, drawn in white; draw_board must have run this frame.
+void draw_completions(const int *completion, int frame)
+{
+    DrawState state = current.state;
+    int i;
+
+    if ((frame >> 2) % 2)
+        return;
+
+    state.primitive = EPrimQuads;
+    state.color = (unsigned char) drawlist_color(&current.list, 1, 1, 1, 1);
+    for (i = 0; i < 4; i++)
+    {
+        int row = completion[i];
+        if (row != -1)
+        {
+            int first = board_cache.rows[row];
+            drawlist_cached(&current.list, &state, board_cache.vertices, board_cache.vbo, first, board_cache.rows[row + 1] - first);
+        }
+    }
+}
+
+void draw_piece(const Piece *piece)
+{
+    const float *color = hi_colors[piece->index];
+    DrawTransform transform;
+
+    current.state.color = (unsigned char) drawlist_color(&current.list, color[0], color[1], color[2], 1);
+    move(&transform, piece->row, (float) piece->col);
+    draw_resident(pieces.patterns + piece->index * 4 + piece->rotation, &transform);
+    current.state.color = 0;
+}
+
+void draw_next(const Graphics *graphics, const Piece *next_pieces, float mu)
+{
+    DrawTransform transform;
+    int i, index;
+
+    PROFILE_BEGIN(EPhaseNext);
+    PASS(EPhaseGpuNext);
+    current.state.texture = graphics->atlas;
+
+    // Index 0 is the outgoing piece;
+    // Index 1 is the incoming piece.
+    for (i = 0; i < 2; i++)
+    {
+        index = next_pieces[i].index;
+        memset(&transform, 0, sizeof(transform));
+        transform.x = (float) BOARD_LEFT + previews[index].col * TILE_WIDTH;
+        transform.y = TILE_START - previews[index].row * TILE_HEIGHT;
+        transform.angle = mu * 360;
+        transform.scale[0] = transform.scale[1] = i ? mu : (1 - mu);
+        current.state.color = (unsigned char) drawlist_color(&current.list, hi_colors[index][0], hi_colors[index][1], hi_colors[index][2], 1);
+        draw_resident(pieces.previews + index, &transform);
+    }
+    current.state.color = 0;
+    PASS(0);
+    PROFILE_END(EPhaseNext);
+}
+
+void draw_overlay()
+{
+    set_color(1, 1, 1, 0.25f);
+    fill(0, 0, BASE_WIDTH, BASE_HEIGHT);
+}
+
+void draw_text(const Graphics *graphics, Font font, const char *text, int left, int top, int level)
+{
+    const int box[4] = { left, top, left, top };
+    float color[4] = { 0, 0.125f, 0.25f, 1 };
+    Layout *layout;
+
+    PROFILE_BEGIN(EPhaseText);
+    PASS(EPhaseGpuText);
+    if (BASIL_INDEX(level) == 3)
+    {
+        color[0] = 0.75f;
+        color[1] = 0.75f;
+        color[2] = 0.25f;
+    }
+
+    layout = find_layout(font, text, box, color);
+    if (!layout->valid)
+    {
+        layout_text(layout, graphics, font, text, left, top);
+        upload_layout(layout);
+    }
+    draw_layout(graphics, layout);
+    PASS(0);
+    PROFILE_END(EPhaseText);
+}
+
+void draw_text_box(const Graphics *graphics, Font font, const char *text, int l, int b, int r, int t)
+{
+    const int box[4] = { l, b, r, t };
+    const float color[4] = { 0, 0, 0, 1 };
+    const float scale = 1.0f / ASSET_SCALE;
+    const float ox = (float) l * (ASSET_SCALE - 1);
+    const float oy = (float) t * (ASSET_SCALE - 1);
+    const float x = (l + ox) * scale;
+    const float y = (b + oy) * scale;
+    const float w = (r - l) * scale;
+    const float h = (t - b) * scale;
+    Layout *layout;
+
+    PROFILE_BEGIN(EPhaseText);
+    PASS(EPhaseGpuText);
+    set_color(1, 1, 1, 0.75f);
+    fill(x, y, w, h);
+
+    set_color(0, 0, 0, 1);
+    outline(x, y, w, h);
+
+    layout = find_layout(font, text, box, color);
+    if (!layout->valid)
+    {
+        layout_text_box(layout, graphics, font, text, l, b, r, t);
+        upload_layout(layout);
+    }
+    draw_layout(graphics, layout);
+    PASS(0);
+    PROFILE_END(EPhaseText);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void set_color(float r, float g, float b, float a)
+{
+    current.color[0] = r;
+    current.color[1] = g;
+    current.color[2] = b;
+    current.color[3] = a;
+}
+
+static Vertex *append(Primitive primitive, int count)
+{
+    current.state.primitive = primitive;
+    return drawlist_append(&current.list, &current.state, count);
+}
+
+static void emit_vertex(Vertex *v, float x, float y)
+{
+    v->x = x;
+    v->y = y;
+    v->s = 0;
+    v->t = 0;
+    v->r = current.color[0];
+    v->g = current.color[1];
+    v->b = current.color[2];
+    v->a = current.color[3];
+}
+
+static Vertex *emit_quad(Vertex *v, float x0, float y0, float x1, float y1, float s0, float t0, float s1, float t1, const float *color)
+{
+    int i;
+
+    v[0].x = x0; v[0].y = y0; v[0].s = s0; v[0].t = t0;
+    v[1].x = x1; v[1].y = y0; v[1].s = s1; v[1].t = t0;
+    v[2].x = x1; v[2].y = y1; v[2].s = s1; v[2].t = t1;
+    v[3].x = x0; v[3].y = y1; v[3].s = s0; v[3].t = t1;
+    for (i = 0; i < 4; i++)
+    {
+        v[i].r = color[0];
+        v[i].g = color[1];
+        v[i].b = color[2];
+        v[i].a = color[3];
+    }
+    return v + 4;
+}
+
+static Vertex *emit_tile(Vertex *v, float col, float row, unsigned char type, const float *color)
+{
+    float w = TILE_WIDTH;
+    float h = TILE_HEIGHT;
+    float x = BOARD_LEFT + w * col;
+    float y = TILE_START - h * row;
+    int i;
+
+    v[0].x = x;     v[0].y = y;
+    v[1].x = x + w; v[1].y = y;
+    v[2].x = x + w; v[2].y = y + h;
+    v[3].x = x;     v[3].y = y + h;
+    for (i = 0; i < 4; i++)
+    {
+        v[i].s = tile_uvs[type][i][0];
+        v[i].t = tile_uvs[type][i][1];
+        v[i].r = color[0];
+        v[i].g = color[1];
+        v[i].b = color[2];
+        v[i].a = color[3];
+    }
+    return v + 4;
+}
+
+static void create_pieces()
+{
+    static const float white[4] = { 1, 1, 1, 1 };
+    const float w = TILE_WIDTH;
+    const float h = TILE_HEIGHT;
+    Vertex *v = pieces.vertices;
+    int i, x, y;
+
+    for (i = 0; i < PIECE_COUNT * 4; i++)
+    {
+        const unsigned short *pattern = patterns[i];
+        const float *color = hi_colors[i / 4];
+
+        pieces.patterns[i].first = (int) (v - pieces.vertices);
+        for (y = 0; y < 4; y++)
+        {
+            unsigned short row = pattern[y];
+            for (x = 0; x < 4; x++, row <<= 4)
+            {
+                if (row & 0xf000)
+                    v = emit_tile(v, (float) x, (float) y, row >> 12, white);
+            }
+        }
+        pieces.patterns[i].count = (int) (v - pieces.vertices) - pieces.patterns[i].first;
+
+        // A streak starts halfway up the column's topmost tile.
+        for (x = 0; x < 4; x++)
+        {
+            Span *streak = pieces.streaks[i] + x;
+            const float bottom[4] = { color[0], color[1], color[2], 1 };
+            const float top[4] = { color[0], color[1], color[2], 0 };
+            float xx = BOARD_LEFT + w * x;
+            float yy;
+
+            streak->first = (int) (v - pieces.vertices);
+            streak->count = 0;
+            for (y = 0; y < 4 && !((pattern[y] << 4 * x) & 0xf000); y++)
+                ;
+            if (y == 4)
+                continue;
+            yy = TILE_START - h * (y + 0.5f - 1);
+            emit_quad(v, xx, yy, xx + w, yy + h, 0, 0, 0, 0, bottom);
+            memcpy(&v[2].r, top, sizeof(top));
+            memcpy(&v[3].r, top, sizeof(top));
+            v += 4;
+            streak->count = 4;
+        }
+    }
+
+    for (i = 0; i < PIECE_COUNT; i++)
+    {
+        const unsigned short *pattern = patterns[i * 4 + previews[i].rotation];
+        float prow = previews[i].row + previews[i].oy - 3;
+        float col = (float) (previews[i].col - previews[i].ox);
+
+        pieces.previews[i].first = (int) (v - pieces.vertices);
+        for (y = 0; y < 4; y++)
+        {
+            unsigned short row = pattern[y];
+            for (x = 0; x < 4; x++, row <<= 4)
+            {
+                if (row & 0xf000)
+                    v = emit_tile(v, col + x, prow + y, row >> 12, white);
+            }
+        }
+        pieces.previews[i].count = (int) (v - pieces.vertices) - pieces.previews[i].first;
+    }
+
+    pieces.vbo = backend_buffer();
+    backend_upload(pieces.vbo, pieces.vertices, (int) (v - pieces.vertices));
+}
+
+static void draw_resident(const Span *span, const DrawTransform *transform)
+{
+    DrawState state = current.state;
+    state.primitive = EPrimQuads;
+    state.transform = (unsigned char) drawlist_transform(&current.list, transform);
+    drawlist_cached(&current.list, &state, pieces.vertices, pieces.vbo, span->first, span->count);
+}
+
+// A plain translation of pattern geometry to the given tile.
+static void move(DrawTransform *transform, float row, float col)
+{
+    memset(transform, 0, sizeof(DrawTransform));
+    transform->scale[0] = transform->scale[1] = 1;
+    transform->offset[0] = TILE_WIDTH * col;
+    transform->offset[1] = -TILE_HEIGHT * row;
+}
+
+static void draw_backboard(float mu, int level)
+{    
+    int x = BOARD_LEFT;
+    int y = BOARD_BOTTOM;
+    int w = BOARD_WIDTH;
+    int h = BOARD_HEIGHT;
+    const float *bottom = colors[(GRADIENT_BOTTOM + level) % (GRADIENT_BOTTOM + 1)];
+    const float *top = colors[GRADIENT_TOP];
+    Vertex *v;
+
+    if (mu <= 0)
+        return;
+
+    if (mu < 1)
+    {
+        w = (int) (w * mu);
+        h = (int) (h * mu);
+    }
+
+    set_color(0, 0, 0, 1);
+    outline((float) x, (float) y, (float) w, (float) h);
+
+    current.state.texture = 0;
+    v = append(EPrimQuads, 4);
+    set_color(bottom[0], bottom[1], bottom[2], bottom[3]);
+    emit_vertex(v + 0, (float) x, (float) y);
+    emit_vertex(v + 1, (float) (x + w), (float) y);
+    set_color(top[0], top[1], top[2], top[3]);
+    emit_vertex(v + 2, (float) (x + w), (float) (y + h));
+    emit_vertex(v + 3, (float) x, (float) (y + h));
+}
+
+static void layout_text(Layout *layout, const Graphics *graphics, Font font, const char *text, int start, int top)
+{
+    int left = start;
+    int c = 0;
+    const char *pText = text;
+    const FontInfo *info = fonts + font;
+    const Region *region = graphics->regions + EAtlasFonts + font;
+    const float *texel = graphics->texel;
+    const float scale = 1.0f / ASSET_SCALE;
+    const float ox = (float) left * (ASSET_SCALE - 1);
+    const float oy = (float) top * (ASSET_SCALE - 1);
+
+    while (pText && *pText)
+    {
+        const Glyph *glyph;
+        float s, t, w, h;
+
+        if (*pText == '\n')
+        {
+            left = start;
+            top -= info->line_height;
+            pText++;
+            c++;
+            continue;
+        }
+
+        glyph = font_glyph(info, *pText);
+        if (!glyph)
+        {
+            pText++;
+            continue;
+        }
+
+        s = region->s + glyph->x * texel[0];
+        t = region->t + (info->height - glyph->y) * texel[1];
+        w = glyph->width * texel[0];
+        h = glyph->height * texel[1];
+
+        if (c > 0)
+            left += font_kerning(info, text[c - 1], text[c]);
+
+        left += glyph->xoffset;
+        top -= glyph->yoffset;
+
+        emit_quad(
+            reserve_layout(layout, 4),
+            (left + ox) * scale, (top + oy) * scale,
+            (left + glyph->width + ox) * scale, (top - glyph->height + oy) * scale,
+            s, t, s + w, t - h,
+            layout->color);
+
+        left -= glyph->xoffset;
+        top += glyph->yoffset;
+        left += glyph->xadvance;
+
+        pText++;
+        c++;
+    }
+}
+
+static void layout_text_box(Layout *layout, const Graphics *graphics, Font font, const char *text, int l, int b, int r, int t)
+{
+    const int wrap = 1;
+    const int padding = 2;
+    int c = 0;
+    const char *pText = text;
+    int left, top;
+    const FontInfo *info = fonts + font;
+    const Region *region = graphics->regions + EAtlasFonts + font;
+    const float *texel = graphics->texel;
+    const float scale = 1.0f / ASSET_SCALE;
+    const float ox = (float) l * (ASSET_SCALE - 1);
+    const float oy = (float) t * (ASSET_SCALE - 1);
+
+    left = l + padding;
+    top = t;
+
+    while (pText && *pText)
+    {
+        const Glyph *glyph;
+        float s, t, w, h;
+
+        if (*pText == '\n')
+        {
+            left = l + padding;
+            top -= info->line_height;
+            pText++;
+            c++;
+            continue;
+        }
+
+        if (*pText == '\t')
+        {
+            left = left + 75;
+            left -= left % 75;
+            pText++;
+            c++;
+            continue;
+        }
+
+        glyph = font_glyph(info, *pText);
+        if (!glyph)
+        {
+            pText++;
+            continue;
+        }
+
+        s = region->s + glyph->x * texel[0];
+        t = region->t + (info->height - glyph->y) * texel[1];
+        w = glyph->width * texel[0];
+        h = glyph->height * texel[1];
+
+        if (c > 0)
+            left += font_kerning(info, text[c - 1], text[c]);
+
+        left += glyph->xoffset;
+        top -= glyph->yoffset;
+
+        // Dumb line wrapping.
+        if (left + glyph->width >= r)
+        {
+            if (wrap)
+            {
+                left = l + padding;
+                top -= info->line_height;
+            }
+            else
+            {
+                pText++;
+                c++;
+                continue;
+            }
+        }
+
+        if (top - glyph->height < b)
+            break;
+
+        emit_quad(
+            reserve_layout(layout, 4),
+            (left + ox) * scale, (top + oy) * scale,
+            (left + glyph->width + ox) * scale, (top - glyph->height + oy) * scale,
+            s, t, s + w, t - h,
+            layout->color);
+
+        left -= glyph->xoffset;
+        top += glyph->yoffset;
+        left += glyph->xadvance;
+
+        pText++;
+        c++;
+    }
+}
+
+static Layout *find_layout(Font font, const char *text, const int *box, const float *color)
+{
+    Layout *layout;
+    Layout *victim = layouts.entries;
+    int i;
+
+    if (!text)
+        text = "";
+
+    layouts.clock++;
+    for (i = 0, layout = layouts.entries; i < LAYOUT_CACHE_SIZE; i++, layout++)
+    {
+        if (layout->valid && layout->font == font &&
+            !memcmp(layout->box, box, sizeof(layout->box)) &&
+            !memcmp(layout->color, color, sizeof(layout->color)) &&
+            !strcmp(layout->text, text))
+        {
+            layout->used = layouts.clock;
+            return layout;
+        }
+        if (!layout->valid || layout->used < victim->used)
+            victim = layout;
+    }
+
+    // Evict the least recently used entry.
+    layout = victim;
+    free(layout->text);
+    layout->text = (char *) malloc(strlen(text) + 1);
+    strcpy(layout->text, text);
+    layout->font = font;
+    memcpy(layout->box, box, sizeof(layout->box));
+    memcpy(layout->color, color, sizeof(layout->color));
+    layout->count = 0;
+    layout->used = layouts.clock;
+    layout->valid = 0;
+    return layout;
+}
+
+static Vertex *reserve_layout(Layout *layout, int count)
+{
+    Vertex *v;
+    if (layout->count + count > layout->capacity)
+    {
+        layout->capacity = max(64, 2 * (layout->count + count));
+        layout->vertices = (Vertex *) realloc(layout->vertices, layout->capacity * sizeof(Vertex));
+    }
+    v = layout->vertices + layout->count;
+    layout->count += count;
+    return v;
+}
+
+static void upload_layout(Layout *layout)
+{
+    layout->valid = 1;
+    backend_upload(layout->vbo, layout->vertices, layout->count);
+}
+
+static void draw_layout(const Graphics *graphics, const Layout *layout)
+{
+    DrawState state = current.state;
+    state.primitive = EPrimQuads;
+    state.texture = graphics->atlas;
+    drawlist_cached(&current.list, &state, layout->vertices, layout->vbo, 0, layout->count);
+}
+
+static void load_backdrop(void *asset)
+{
+    Asset *a = (Asset *) asset;
+    a->pixels = backend_decode_backdrop(a->source);
+}
+
+static void load_tile(void *asset)
+{
+    Asset *a = (Asset *) asset;
+    unsigned char *pixels = (unsigned char *) malloc(2 * TILE_SIZE * TILE_SIZE + 1);
+    unsigned char *tile;
+    int y;
+
+    decode(pixels, a->source);
+    tile = expand(pixels, TILE_SIZE * TILE_SIZE, 2);
+    for (y = 0; y < TILE_SIZE; y++)
+        memcpy(a->image->rgba + 4 * (y * TILEBANK_WIDTH + a->index * TILE_POT_SIZE), tile + 4 * y * TILE_SIZE, 4 * TILE_SIZE);
+    free(tile);
+    free(pixels);
+}
+
+static void load_title(void *asset)
+{
+    Asset *a = (Asset *) asset;
+
+    a->image->width = TITLE_WIDTH;
+    a->image->height = TITLE_HEIGHT;
+    a->image->rgba = (unsigned char *) malloc(4 * TITLE_WIDTH * TITLE_HEIGHT + 1);
+    if (assets->title_compressed)
+        decode_dxt5(TITLE_WIDTH, TITLE_HEIGHT, a->image->rgba, a->source);
+    else
+        decode(a->image->rgba, a->source);
+}
+
+static void load_philip(void *asset)
+{
+    Asset *a = (Asset *) asset;
+    unsigned char *pixels = (unsigned char *) malloc(PHILIP_WIDTH * PHILIP_HEIGHT + 1);
+
+    decode(pixels, a->source);
+    a->image->width = PHILIP_WIDTH;
+    a->image->height = PHILIP_HEIGHT;
+    a->image->rgba = expand(pixels, PHILIP_WIDTH * PHILIP_HEIGHT, 1);
+    free(pixels);
+}
+
+static void load_font(void *asset)
+{
+    Asset *a = (Asset *) asset;
+    FontInfo *font = fonts + a->index;
+    unsigned char *pixels;
+
+    font_create(font);
+    pixels = (unsigned char *) malloc(font->width * font->height + 1);
+    decode(pixels, font->image);
+    a->image->width = font->width;
+    a->image->height = font->height;
+    a->image->rgba = expand(pixels, font->width * font->height, 1);
+    free(pixels);
+}
+
+// Packs the decoded images into a single RGBA atlas, and frees them.
+static void create_atlas(Graphics *graphics, AtlasImage *images)
+{
+    unsigned char *pixels;
+    int i, x, width, height;
+
+    width = ATLAS_WIDTH;
+    for (i = 0; i < ATLAS_COUNT; i++)
+        width = max(width, npot(images[i].width));
+    height = pack_atlas(images, ATLAS_COUNT, width);
+
+    pixels = (unsigned char *) calloc(4 * width * height, 1);
+    for (i = 0; i < ATLAS_COUNT; i++)
+    {
+        AtlasImage *image = images + i;
+        place_image(pixels, width, image);
+        graphics->regions[i].s = (float) image->x / width;
+        graphics->regions[i].t = (float) image->y / height;
+        free(image->rgba);
+    }
+    graphics->texel[0] = 1.0f / width;
+    graphics->texel[1] = 1.0f / height;
+
+    graphics->atlas = backend_texture(width, height, pixels);
+    free(pixels);
+
+    for (i = 0; i < 16; i++)
+    {
+        for (x = 0; x < 4; x++)
+        {
+            tile_uvs[i][x][0] = graphics->regions[EAtlasTiles].s + tile_coords[i][x][0] * TILEBANK_WIDTH * graphics->texel[0];
+            tile_uvs[i][x][1] = graphics->regions[EAtlasTiles].t + tile_coords[i][x][1] * TILEBANK_HEIGHT * graphics->texel[1];
+        }
+    }
+}
+
+// Converts single-channel alpha (1) or luminance-alpha (2) pixels to RGBA, which
+// modulates identically to GL_MODULATE.
+static unsigned char *expand(const unsigned char *src, int count, int channels)
+{
+    unsigned char *rgba = (unsigned char *) malloc(4 * count);
+    unsigned char *dest = rgba;
+    int i;
+
+    for (i = 0; i < count; i++, src += channels, dest += 4)
+    {
+        unsigned char l = (channels == 2) ? src[0] : 255;
+        dest[0] = l;
+        dest[1] = l;
+        dest[2] = l;
+        dest[3] = src[channels - 1];
+    }
+    return rgba;
+}
+
+// Shelf packer: images are placed tallest first, left to right, starting a new
+// shelf when a row fills up.  Returns the power-of-two atlas height.
+//
+// The first image stays at the origin, so its texture coordinates are an exact
+// power-of-two rescale of the originals.  Tiles are drawn at fractional and rotated
+// positions, and any other offset changes which texel GL_NEAREST rounds to.
+static int pack_atlas(AtlasImage *images, int count, int width)
+{
+    int order[ATLAS_COUNT];
+    int i, j, x = 0, y = 0, shelf = 0;
+
+    order[0] = 0;
+    for (i = 1; i < count; i++)
+    {
+        for (j = i; j > 1 && images[order[j - 1]].height < images[i].height; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        AtlasImage *image = images + order[i];
+        if (x + image->width > width)
+        {
+            y += shelf;
+            x = 0;
+            shelf = 0;
+        }
+        image->x = x;
+        image->y = y;
+        x += image->width;
+        shelf = max(shelf, image->height);
+    }
+
+    return npot(y + shelf);
+}
+
+static void place_image(unsigned char *pixels, int width, const AtlasImage *image)
+{
+    int y;
+    for (y = 0; y < image->height; y++)
+        memcpy(pixels + 4 * ((image->y + y) * width + image->x), image->rgba + 4 * y * image->width, 4 * image->width);
+}
+
+static void blit(unsigned int texture, const float *uv, int x, int y, int w, int h, float scale)
+{
+    float xx = (float) x;
+    float yy = (float) y;
+    current.state.texture = texture;
+    emit_quad(append(EPrimQuads, 4), xx, yy, xx + w * scale, yy + h * scale, uv[0], uv[1], uv[2], uv[3], current.color);
+}
+
+static void fill(float x, float y, float w, float h)
+{
+    Vertex *v;
+    current.state.texture = 0;
+    v = append(EPrimQuads, 4);
+    emit_vertex(v + 0, x, y);
+    emit_vertex(v + 1, x + w, y);
+    emit_vertex(v + 2, x + w, y + h);
+    emit_vertex(v + 3, x, y + h);
+}
+
+static void outline(float x, float y, float w, float h)
+{
+    const float oa = -1.0f / (VIEW_SCALE * 2);
+    const float ob = +1.0f / (VIEW_SCALE * 2);
+    const float corners[4][2] =
+    {
+        { x + oa, y + oa },
+        { x + w + ob, y + oa },
+        { x + w + ob, y + h + ob },
+        { x + oa, y + h + ob },
+    };
+    Vertex *v;
+    int i;
+
+    // Shift from pixel boundaries to pixel centers using oa and ob; the points fill in the corners.
+    current.state.texture = 0;
+    v = append(EPrimLines, 8);
+    for (i = 0; i < 4; i++)
+    {
+        emit_vertex(v++, corners[i][0], corners[i][1]);
+        emit_vertex(v++, corners[(i + 1) % 4][0], corners[(i + 1) % 4][1]);
+    }
+    v = append(EPrimPoints, 4);
+    for (i = 0; i < 4; i++)
+        emit_vertex(v++, corners[i][0], corners[i][1]);
+}
+
+// A target last drawn age frames ago also misses the damage of the frames since, so
+// their rects are added to this frame's.  A full redraw is left for when the target is
+// undefined, older than the history, or the rects don't fit.
+static void widen_damage(int age)
+{
+    DrawDamage *grid = &damage.grid;
+    int count = grid->rect_count;
+    int i;
+
+    if (grid->full)
+    {
+        damage.frames = 0;
+        return;
+    }
+
+    if (age < 1 || age - 1 > damage.frames)
+        grid->full = 1;
+    for (i = 0; !grid->full && i < age - 1; i++)
+    {
+        if (grid->rect_count + damage.counts[i] > DRAW_DAMAGE_CAPACITY)
+            grid->full = 1;
+        else
+        {
+            memcpy(grid->rects + grid->rect_count, damage.history[i], damage.counts[i] * sizeof(DrawRect));
+            grid->rect_count += damage.counts[i];
+        }
+    }
+
+    memmove(damage.history + 1, damage.history, (DAMAGE_HISTORY - 1) * sizeof(damage.history[0]));
+    memmove(damage.counts + 1, damage.counts, (DAMAGE_HISTORY - 1) * sizeof(int));
+    memcpy(damage.history[0], grid->rects, count * sizeof(DrawRect));
+    damage.counts[0] = count;
+    damage.frames = min(damage.frames + 1, DAMAGE_HISTORY);
+
+    if (grid->full)
+    {
+        grid->rect_count = 1;
+        grid->rects[0].x0 = 0;
+        grid->rects[0].y0 = 0;
+        grid->rects[0].x1 = grid->width;
+        grid->rects[0].y1 = grid->height;
+    }
+}
@@ -4,773 +4,450 @@
 #include "os.h"
 #include "draw.h"
 #include "image.h"
+#include "profile.h"
+#include "backend.h"
+#include "stream.h"
 #include "GL/gl.h"
 #include "GL/glext.h"
 
 extern PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC glCompressedTexSubImage2D;
 extern PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2D;
+extern PFNGLGENBUFFERSPROC glGenBuffers;
+extern PFNGLDELETEBUFFERSPROC glDeleteBuffers;
+extern PFNGLBINDBUFFERPROC glBindBuffer;
+extern PFNGLBUFFERDATAPROC glBufferData;
+
+// The frame's sorted vertices go through a stream when the driver has buffer objects,
+// landing at stream_offset, or client arrays on 1.1.
+#define STREAM_CAPACITY (64 * 1024)
+
+static Stream stream;
+static int stream_offset;
+
+// The capabilities, bindings and color this backend changes, as last set, so that
+// calls which wouldn't change anything never reach the driver.  Nothing else touches
+// them between frames, so state carries over from one frame to the next instead of
+// being reset after each.  Unknown values are -1.
+typedef enum
+{
+    ECapTexture,
+    ECapScissor,
+    ECapBlend,
+    ECapVertexArray,
+    ECapTexCoordArray,
+    ECapColorArray,
+} Cap;
+
+#define CAP_COUNT 6
 
-struct GraphicsRec
+static const GLenum caps[CAP_COUNT] =
 {
-    GLuint backdrops[BASIL_COUNT];
-    GLuint title;
-    GLuint philip;
-    GLuint tilemap;
-    GLuint fonts[FONT_COUNT];
+    GL_TEXTURE_2D,
+    GL_SCISSOR_TEST,
+    GL_BLEND,
+    GL_VERTEX_ARRAY,
+    GL_TEXTURE_COORD_ARRAY,
+    GL_COLOR_ARRAY,
 };
 
-static void draw_tile(float col, float row, unsigned char type);
-static void draw_pattern(const unsigned short *pattern, float row, float col);
-static void draw_backboard(float mu, int level);
+static struct
+{
+    int enabled[CAP_COUNT];
+    GLuint texture;
+    GLuint buffer;
+    float color[4];
+    int color_known;
+    unsigned int issued;
+    unsigned int elided;
+} cache;
+
 static GLuint create_texture(int linear);
-static void blit(int x, int y, int w, int h, float scale);
-static void fill(int x, int y, int w, int h);
-static void outline(int x, int y, int w, int h);
+static void replay(const DrawList *list, const DrawRect *rect);
+static void set_scissor(const DrawRect *rect, int board);
+static void forget_state();
+static void set_cap(Cap cap, int enable);
+static void bind_texture(GLuint texture);
+static void bind_buffer(GLuint buffer);
+static void set_color(float r, float g, float b, float a);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Graphics *draw_create()
+void backend_init()
 {
-    Graphics *graphics = (Graphics *) malloc(sizeof(Graphics));
-    unsigned char *philip_a;
-    unsigned char *tile_la;
-    unsigned char *font_la;
-    unsigned char *backdrop_dxt = 0;
-    unsigned char *backdrop_rgb = 0;
     int x = BOARD_LEFT * VIEW_SCALE;
     int y = BOARD_BOTTOM * VIEW_SCALE;
     int w = BOARD_WIDTH * VIEW_SCALE;
     int h = BOARD_HEIGHT * VIEW_SCALE;
-    int i, size;
 
+    forget_state();
+    glViewport(0, 0, VIEW_WIDTH, VIEW_HEIGHT);
     glScissor(x, y, w, h);
-    glEnable(GL_BLEND);
+    set_cap(ECapBlend, 1);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glMatrixMode(GL_PROJECTION);
-    glOrtho(0, 480, 0, 320, 0, 10);
+    glOrtho(0, BASE_WIDTH, 0, BASE_HEIGHT, 0, 10);
     glMatrixMode(GL_MODELVIEW);
 
-    // Load the backdrop textures.
-    if (glCompressedTexImage2D)
-    {
-        size = BACKDROP_WIDTH * BACKDROP_HEIGHT / 2;
-        backdrop_dxt = (unsigned char *) malloc(size + 1);
-    }
-    else
-    {
-        backdrop_rgb = (unsigned char *) malloc(BACKDROP_WIDTH * BACKDROP_HEIGHT * 3);
-    }
-    for (i = 0; i < BASIL_COUNT; i++)
-    {
-        const char **backdrop_image;
-        switch (i)
-        {
-            case 0: backdrop_image = basil1_image; break;
-            case 1: backdrop_image = basil2_image; break;
-            case 2: backdrop_image = basil3_image; break;
-            case 3: backdrop_image = basil4_image; break;
-        }
-        graphics->backdrops[i] = create_texture(0);
-        if (glCompressedTexImage2D)
-        {
-            decode(backdrop_dxt, backdrop_image);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-            glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, backdrop_dxt);
-        }
-        else
-        {
-            decode_dxt1(BACKDROP_WIDTH, BACKDROP_HEIGHT, backdrop_rgb, backdrop_image);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, backdrop_rgb);
-        }
-    }
-    free(backdrop_dxt);
-    free(backdrop_rgb);
-
-    // Load the title texture.
-    graphics->title = create_texture(0);
-    if (VIEW_SCALE > 1)
-    {
-        if (glCompressedTexImage2D)
-        {
-            int size = TITLE_WIDTH * TITLE_HEIGHT;
-            unsigned char *title_dxt = (unsigned char *) malloc(size + 1);
-            decode(title_dxt, title_image);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, npot(TITLE_WIDTH), npot(TITLE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-            glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TITLE_WIDTH, TITLE_HEIGHT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, size, title_dxt);
-            free(title_dxt);
-        }
-        else
-        {
-            unsigned char *title_rgba = (unsigned char *) malloc(TITLE_WIDTH * TITLE_HEIGHT * 4);
-            decode_dxt5(TITLE_WIDTH, TITLE_HEIGHT, title_rgba, title_image);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, npot(TITLE_WIDTH), npot(TITLE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TITLE_WIDTH, TITLE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, title_rgba);
-            free(title_rgba);
-        }
-    }
-    else
-    {
-        unsigned char *title_rgba = (unsigned char *) malloc(4 * TITLE_WIDTH * TITLE_HEIGHT + 1);
-        decode(title_rgba, title_image);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, npot(TITLE_WIDTH), npot(TITLE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TITLE_WIDTH, TITLE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, title_rgba);
-        free(title_rgba);
-    }
-
-    // Load the author texture.
-    graphics->philip = create_texture(0);
-    philip_a = (unsigned char *) malloc(PHILIP_WIDTH * PHILIP_HEIGHT + 1);
-    decode(philip_a, philip_image);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, npot(PHILIP_WIDTH), npot(PHILIP_HEIGHT), 0, GL_ALPHA, GL_UNSIGNED_BYTE, 0);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PHILIP_WIDTH, PHILIP_HEIGHT, GL_ALPHA, GL_UNSIGNED_BYTE, philip_a);
-    free(philip_a);
-
-    // Load the tile textures.
-    graphics->tilemap = create_texture(0);
-    tile_la = (unsigned char *) malloc(2 * TILE_SIZE * TILE_SIZE + 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, TILEBANK_WIDTH, TILEBANK_HEIGHT, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, 0);
-    for (y = 0, x = 0; y < TILE_COUNT; y++, x += TILE_POT_SIZE)
-    {
-        decode(tile_la, tile_images[y]);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, x, 0, TILE_SIZE, TILE_SIZE, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, tile_la);
-    }
-    free(tile_la);
-
-    // Load the font atlases.
-    for (x = 0; x < FONT_COUNT; x++)
-    {
-        graphics->fonts[x] = create_texture(0);
-        font_la = (unsigned char *) malloc(fonts[x].width * fonts[x].height + 1);
-        decode(font_la, fonts[x].image);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, fonts[x].width, fonts[x].height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, font_la);
-        free(font_la);
-    }
-
-    return graphics;
+    if (glGenBuffers)
+        stream_create(&stream, STREAM_CAPACITY);
+    PROFILE_GPU_INIT();
 }
 
-void draw_destroy(Graphics *graphics)
+void backend_shutdown()
 {
-    int x;
-    for (x = 0; x < BASIL_COUNT; x++)
-        glDeleteTextures(1, &graphics->backdrops[x]);
-    glDeleteTextures(1, &graphics->title);
-    glDeleteTextures(1, &graphics->philip);
-    glDeleteTextures(1, &graphics->tilemap);
-    for (x = 0; x < FONT_COUNT; x++)
-        glDeleteTextures(1, &graphics->fonts[x]);
-    free(graphics);
+    PROFILE_GPU_SHUTDOWN();
+    stream_destroy(&stream);
+    cache.buffer = (GLuint) -1;
 }
 
-void draw_background(const Graphics *graphics, float frame, int level)
+void backend_resize()
 {
-    float mu;
-    float scale = 1.0f / VIEW_SCALE;
-    int index = BASIL_INDEX(level);
-
-    glClear(GL_COLOR_BUFFER_BIT);
-    glColor4f(1, 1, 1, 1);
-    glBindTexture(GL_TEXTURE_2D, graphics->backdrops[index]);
-    blit(0, 0, VIEW_WIDTH, VIEW_HEIGHT, 1.0f / VIEW_SCALE);
-
-    mu = clamp(frame / 0.25f);
-    glColor4f(1, 1, 1, mu);
-    glBindTexture(GL_TEXTURE_2D, graphics->title);
-    blit(30, 250, TITLE_WIDTH, TITLE_HEIGHT, scale);
-
-    mu = clamp((frame - 0.25f) / 0.25f);
-    if (index == 3)
-        glColor4f(1, 1, 1, mu);
-    else
-        glColor4f(0, 0, 0, mu);
-    glBindTexture(GL_TEXTURE_2D, graphics->philip);
-    blit(35, 220, PHILIP_WIDTH, PHILIP_HEIGHT, scale);
+    const DrawRect view = { 0, 0, BASE_WIDTH, BASE_HEIGHT };
 
-    mu = clamp((frame - 0.5f) / 0.25f);
-    draw_backboard(mu, level);
+    glViewport(0, 0, VIEW_WIDTH, VIEW_HEIGHT);
+    set_scissor(&view, 1);
 }
 
-void draw_begin_tiles(const Graphics *graphics)
+int backend_buffer_age()
 {
-    glEnable(GL_SCISSOR_TEST);
-    glBindTexture(GL_TEXTURE_2D, graphics->tilemap);
-    glEnable(GL_TEXTURE_2D);
-    glBegin(GL_QUADS);
+    return osBufferAge();
 }
 
-void draw_end_tiles()
+// DXT1 blocks where S3TC is exposed, RGB otherwise.
+unsigned char *backend_decode_backdrop(const char **image)
 {
-    glEnd();
-    glDisable(GL_SCISSOR_TEST);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_SCISSOR_TEST);
-}
+    unsigned char *pixels;
 
-void draw_blur(const Piece *piece, int frame)
-{
-    const unsigned short *pattern = patterns[piece->index * 4 + piece->rotation];
-    float r = hi_colors[piece->index][0];
-    float g = hi_colors[piece->index][1];
-    float b = hi_colors[piece->index][2];
-    float w = TILE_WIDTH;
-    float h = TILE_HEIGHT;
-    unsigned char occupied[4][4] = {0};
-    float tops[4] = {-1, -1, -1, -1};
-    int x, y;
-
-    for (y = 0; y < 4; y++)
-    {
-        unsigned short row = *pattern++;
-        for (x = 0; x < 4; x++, row <<= 4)
-        {
-            if (row & 0xf000)
-                occupied[x][y] = 1;
-        }
-    }
-
-    for (x = 0; x < 4; x++)
+    if (glCompressedTexImage2D)
     {
-        for (y = 3; y >= 0; y--)
-        {
-            if (occupied[x][y])
-                tops[x] = y + 0.5f;
-        }
+        pixels = (unsigned char *) malloc(BACKDROP_WIDTH * BACKDROP_HEIGHT / 2 + 1);
+        decode(pixels, image);
     }
-
-    glEnable(GL_SCISSOR_TEST);
-    for (x = 0; x < 4; x++)
+    else
     {
-        if (tops[x] != -1)
-        {
-            float xx = BOARD_LEFT + w * (piece->col + x);
-            float yy = TILE_START - h * (piece->row + tops[x] - 1);
-
-            glBegin(GL_QUAD_STRIP);
-            glColor4f(r, g, b, 1);
-            glVertex2f(xx, yy);
-            glVertex2f(xx + w, yy);
-
-            glColor4f(r, g, b, 0);
-            glVertex2f(xx, yy + frame * h);
-            glVertex2f(xx + w, yy + frame * h);
-            glEnd();
-        }
+        pixels = (unsigned char *) malloc(BACKDROP_WIDTH * BACKDROP_HEIGHT * 3);
+        decode_dxt1(BACKDROP_WIDTH, BACKDROP_HEIGHT, pixels, image);
     }
-    glDisable(GL_SCISSOR_TEST);
-    glColor4f(1, 1, 1, 1);
+    return pixels;
 }
 
-void draw_guide(const Piece *piece, int level)
+unsigned int backend_backdrop(const unsigned char *pixels)
 {
-    const float w = TILE_WIDTH;
-    const float h = TILE_HEIGHT;
-    const float yy = BOARD_BOTTOM;
-    const unsigned short *pattern = patterns[piece->index * 4 + piece->rotation];
-    int x;
-    int y;
-
-    if (BASIL_INDEX(level) == 2)
-        glColor4f(1, 1, 1, 1);
-    else
-        glColor4f(1, 1, 1, 0.7f);
+    GLuint texture = create_texture(0);
 
-    glBegin(GL_QUADS);
-    for (x = 0; x < 4; x++)
+    if (glCompressedTexImage2D)
     {
-        for (y = 0; y < 4; y++)
-        {
-            unsigned short row = pattern[y];
-            row <<= 4 * x;
-            if (row & 0xf000)
-            {
-                float xx = BOARD_LEFT + w * (piece->col + x);
-                glVertex2f(xx, yy - 0.75f);
-                glVertex2f(xx + w, yy - 0.75f);
-                glVertex2f(xx + w, yy - GUIDE_WIDTH);
-                glVertex2f(xx, yy - GUIDE_WIDTH);
-                break;
-            }
-        }
+        int size = BACKDROP_WIDTH * BACKDROP_HEIGHT / 2;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, pixels);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixels);
     }
-    glEnd();
-    glColor4f(1, 1, 1, 1);
+    return texture;
 }
 
-void draw_lock(const Piece *piece, float mu)
+unsigned int backend_texture(int width, int height, const unsigned char *rgba)
 {
-    const float *color = hi_colors[piece->index];
-    const unsigned short *pattern = patterns[piece->index * 4 + piece->rotation];
-    glColor4f(color[0], color[1], color[2], 1 - mu);
-    draw_pattern(pattern, piece->row, piece->col - 2 * mu);
-    draw_pattern(pattern, piece->row, piece->col + 2 * mu);
+    GLuint texture = create_texture(0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    return texture;
 }
 
-void draw_board(const TileRow *board)
+// Deleting a bound texture or buffer reverts the binding to 0.
+void backend_delete_texture(unsigned int texture)
 {
-    int row, col;
-    for (row = 0; row < ROW_COUNT; row++)
-    {
-        for (col = 0; col < COL_COUNT; col++)
-        {
-            unsigned char c = board[row][col];
-            if (c)
-            {
-                glColor3fv(colors[c >> 4]);
-                draw_tile((float) col, (float) row, c & 0xf);
-            }
-        }
-    }
+    glDeleteTextures(1, &texture);
+    if (cache.texture == texture)
+        cache.texture = 0;
 }
 
-void draw_completions(const TileRow *board, const int *completion, int frame)
+unsigned int backend_buffer()
 {
-    int i;
+    GLuint buffer = 0;
+    if (glGenBuffers)
+        glGenBuffers(1, &buffer);
+    return buffer;
+}
 
-    if ((frame >> 2) % 2)
+void backend_upload(unsigned int buffer, const Vertex *vertices, int count)
+{
+    if (!buffer || !count)
         return;
-
-    glColor4f(1, 1, 1, 1);
-    for (i = 0; i < 4; i++)
-    {
-        int row = completion[i];
-        if (row != -1)
-        {
-            int col;
-            for (col = 0; col < COL_COUNT; col++)
-                draw_tile((float) col, (float) row, board[row][col] & 0xf);
-        }
-    }
+    bind_buffer(buffer);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 }
 
-void draw_piece(const Piece *piece)
+void backend_delete_buffer(unsigned int buffer)
 {
-    const unsigned short *pattern = patterns[piece->index * 4 + piece->rotation];
-    glColor3fv(hi_colors[piece->index]);
-    draw_pattern(pattern, piece->row, (float) piece->col);
+    if (!buffer)
+        return;
+    glDeleteBuffers(1, &buffer);
+    if (cache.buffer == buffer)
+        cache.buffer = 0;
 }
 
-void draw_next(const Graphics *graphics, const Piece *next_pieces, float mu)
+// A partial redraw replays the list once per damaged rectangle, scissored to it, over
+// the previous frame.  That's only left in the back buffer if the OS layer says so;
+// otherwise the whole frame is redrawn.
+void backend_submit(const DrawList *list)
 {
-    int i, index;
+    static const DrawRect view = { 0, 0, BASE_WIDTH, BASE_HEIGHT };
+    const DrawDamage *damage = list->damage;
+    int i;
 
-    struct
+    PROFILE_GPU_FRAME();
+
+    // The counts cover everything since the previous frame was submitted.
+    PROFILE_COUNT(ECounterStateIssued, cache.issued);
+    PROFILE_COUNT(ECounterStateElided, cache.elided);
+    cache.issued = cache.elided = 0;
+
+    // The stream binds its buffer behind the cache's back.
+    if (stream.buffer && list->vertex_count && list->batch_count)
     {
-        int rotation;
-        float row;
-        int col;
-        int ox;
-        float oy;
+        int size = list->vertex_count * sizeof(Vertex);
+        stream_begin(&stream, size);
+        stream_offset = stream_write(&stream, list->sorted, size);
+        cache.buffer = (GLuint) -1;
     }
-    pieces[PIECE_COUNT] = 
-    {
-        0, 15, -15, 1, 1,
-        0, 12, -18, 1, 1.5,
-        0, 11, -16, 2, 2.5,
-        0, 12, -16, 2, 1,
-        1, 12, -15, 1, 1.5,
-        1, 15, -17, 2, 1.5,
-        1, 16, -15, 2, 1.5,
-    }, *piece;
-
-    glBindTexture(GL_TEXTURE_2D, graphics->tilemap);
-    glEnable(GL_TEXTURE_2D);
-
-    // Index 0 is the outgoing piece;
-    // Index 1 is the incoming piece.
-    for (i = 0; i < 2; i++)
+
+    if (!damage || damage->full)
     {
-        index = next_pieces[i].index;
-        piece = pieces + index;
-        glPushMatrix();
-        glTranslatef
-        (
-            (float) BOARD_LEFT + piece->col * TILE_WIDTH,
-            TILE_START - piece->row * TILE_HEIGHT,
-            0
-        );
-        glRotatef(mu * 360, 0, 0, 1);
-        glScalef(i ? mu : (1 - mu), i ? mu : (1 - mu), 1);
-        glTranslatef
-        (
-            (float) -BOARD_LEFT - piece->col * TILE_WIDTH,
-            -TILE_START + piece->row * TILE_HEIGHT,
-            0
-        );
-        glBegin(GL_QUADS);
-        glColor4f(hi_colors[index][0], hi_colors[index][1], hi_colors[index][2], 1);
-        draw_pattern(patterns[index * 4 + piece->rotation],
-            piece->row + piece->oy - 3,
-            (float) piece->col - piece->ox
-        );
-        glEnd();
-        glPopMatrix();
+        if (list->clear)
+            glClear(GL_COLOR_BUFFER_BIT);
+        replay(list, 0);
+        return;
     }
 
-    glDisable(GL_TEXTURE_2D);
+    set_cap(ECapScissor, 1);
+    for (i = 0; i < damage->rect_count; i++)
+    {
+        set_scissor(damage->rects + i, 0);
+        if (list->clear)
+            glClear(GL_COLOR_BUFFER_BIT);
+        replay(list, damage->rects + i);
+    }
+    set_cap(ECapScissor, 0);
+    set_scissor(&view, 1);
 }
 
-void draw_overlay()
-{
-    glColor4f(1, 1, 1, 0.25f);
-    fill(0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT);
-    glColor4f(1, 1, 1, 1);
-}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void draw_text(const Graphics *graphics, Font font, const char *text, int start, int top, int level)
+static GLuint create_texture(int linear)
 {
-    int left = start;
-    int c = 0;
-    const char *pText = text;
-    const FontInfo *info = fonts + font;
-
-    glPushMatrix();
-    glScalef(1.0f / VIEW_SCALE, 1.0f / VIEW_SCALE, 1.0f / VIEW_SCALE);
-    glTranslatef((float) left * (VIEW_SCALE - 1), (float) top * (VIEW_SCALE - 1), 0);
-
-    if (BASIL_INDEX(level) == 3)
-        glColor4f(0.75f, 0.75f, 0.25f, 1);
+    GLuint id;
+    glGenTextures(1, &id);
+    bind_texture(id);
+    if (linear)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
     else
-        glColor4f(0, 0.125f, 0.25f, 1);
-
-    glBindTexture(GL_TEXTURE_2D, graphics->fonts[font]);
-    glEnable(GL_TEXTURE_2D);
-    glBegin(GL_QUADS);
-    while (pText && *pText)
     {
-        const Glyph *glyph = info->glyphs;
-        float s, t, w, h;
-
-        if (*pText == '\n')
-        {
-            left = start;
-            top -= info->line_height;
-            pText++;
-            c++;
-            continue;
-        }
-
-        while (glyph->id)
-        {
-            if (glyph->id == *pText)
-                break;
-            glyph++;
-        }
-
-        if (!glyph->id)
-        {
-            pText++;
-            continue;
-        }
-
-        s = (float) glyph->x / info->width;
-        t = 1.0f - (float) glyph->y / info->height;
-        w = (float) glyph->width / info->width;
-        h = (float) glyph->height / info->height;
-
-        if (c > 0)
-        {
-            unsigned short first = text[c - 1];
-            unsigned short second = text[c];
-            const Kerning *k;
-
-            for (k = info->pairs; k && k->first; k++)
-            {
-                if (k->first == first && k->second == second)
-                {
-                    left += k->amount;
-                    break;
-                }
-            }
-        }
-
-        left += glyph->xoffset;
-        top -= glyph->yoffset;
-
-        glTexCoord2f(s, t);
-        glVertex2i(left, top);
-
-        glTexCoord2f(s + w, t);
-        glVertex2i(left + glyph->width, top);
-
-        glTexCoord2f(s + w, t - h);
-        glVertex2i(left + glyph->width, top - glyph->height);
-
-        glTexCoord2f(s, t - h);
-        glVertex2i(left, top - glyph->height);
-
-        left -= glyph->xoffset;
-        top += glyph->yoffset;
-        left += glyph->xadvance;
-
-        pText++;
-        c++;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
-    glEnd();
-    glDisable(GL_TEXTURE_2D);
-    glPopMatrix();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    return id;
 }
 
-void draw_text_box(const Graphics *graphics, Font font, const char *text, int l, int b, int r, int t)
+// Replays the sorted batches.  Capabilities, bindings and the color go through the
+// cache; the scissor box and the matrix, which depend on the batch, are tracked here.
+// With a rectangle, the scissor test is already on and stays on.
+static void replay(const DrawList *list, const DrawRect *rect)
 {
-    const int wrap = 1;
-    const int padding = 2;
-    int c = 0;
-    const char *pText = text;
-    int left, top;
-    const FontInfo *info = fonts + font;
-
-    left = l + padding;
-    top = t;
-
-    glPushMatrix();
-    glScalef(1.0f / VIEW_SCALE, 1.0f / VIEW_SCALE, 1.0f / VIEW_SCALE);
-    glTranslatef((float) l * (VIEW_SCALE - 1), (float) t * (VIEW_SCALE - 1), 0);
-
-    glColor4f(1, 1, 1, 0.75f);
-    fill(l, b, r - l, t - b);
-
-    glColor4f(0, 0, 0, 1);
-    outline(l, b, r - l, t - b);
-
-    glBindTexture(GL_TEXTURE_2D, graphics->fonts[font]);
-    glEnable(GL_TEXTURE_2D);
-    glBegin(GL_QUADS);
-    while (pText && *pText)
-    {
-        const Glyph *glyph = info->glyphs;
-        float s, t, w, h;
+    static const GLenum modes[] = { GL_QUADS, GL_LINES, GL_POINTS };
+    const Vertex *pointed = 0;
+    int scissor = 0;
+    int transform = 0;
+    GLuint pointed_vbo = 0;
+    int i, first = 1;
+
+    if (!list->batch_count)
+        return;
 
-        if (*pText == '\n')
-        {
-            left = l + padding;
-            top -= info->line_height;
-            pText++;
-            c++;
-            continue;
-        }
+    set_cap(ECapVertexArray, 1);
+    set_cap(ECapTexCoordArray, 1);
+    for (i = 0; i < list->batch_count; i++)
+    {
+        const DrawBatch *batch = list->batches + i;
+        const DrawState *state = &batch->state;
+        const Vertex *source = batch->source ? batch->source : list->sorted;
+        GLuint vbo = batch->source ? batch->buffer : stream.buffer;
 
-        if (*pText == '\t')
+        PROFILE_GPU_PASS(state->pass);
+        if (state->primitive == EPrimCapture)
         {
-            left = left + 75;
-            left -= left % 75;
-            pText++;
-            c++;
+            bind_texture(state->texture);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, VIEW_WIDTH, VIEW_HEIGHT);
             continue;
         }
 
-        while (glyph->id)
+        set_cap(ECapTexture, state->texture != 0);
+        if (state->texture)
+            bind_texture(state->texture);
+        if (rect)
         {
-            if (glyph->id == *pText)
-                break;
-            glyph++;
+            if (state->scissor != scissor)
+                set_scissor(rect, state->scissor);
         }
-
-        if (!glyph->id)
+        else
         {
-            pText++;
-            continue;
+            set_cap(ECapScissor, state->scissor);
         }
+        scissor = state->scissor;
+        set_cap(ECapBlend, state->blend);
 
-        s = (float) glyph->x / info->width;
-        t = 1.0f - (float) glyph->y / info->height;
-        w = (float) glyph->width / info->width;
-        h = (float) glyph->height / info->height;
-
-        if (c > 0)
+        if (state->transform != transform)
         {
-            unsigned short first = text[c - 1];
-            unsigned short second = text[c];
-            const Kerning *k;
-
-            for (k = info->pairs; k && k->first; k++)
+            const DrawTransform *t = list->transforms + state->transform;
+            glLoadIdentity();
+            if (state->transform)
             {
-                if (k->first == first && k->second == second)
-                {
-                    left += k->amount;
-                    break;
-                }
+                glTranslatef(t->x + t->offset[0], t->y + t->offset[1], 0);
+                glRotatef(t->angle, 0, 0, 1);
+                glScalef(t->scale[0], t->scale[1], 1);
+                glTranslatef(-t->x, -t->y, 0);
             }
+            transform = state->transform;
         }
 
-        left += glyph->xoffset;
-        top -= glyph->yoffset;
-
-        // Dumb line wrapping.
-        if (left + glyph->width >= r)
+        // A solid color stands in for the color array.
+        set_cap(ECapColorArray, !state->color);
+        if (state->color)
         {
-            if (wrap)
-            {
-                left = l + padding;
-                top -= info->line_height;
-            }
-            else
-            {
-                pText++;
-                c++;
-                continue;
-            }
+            const float *color = list->colors[state->color];
+            set_color(color[0], color[1], color[2], color[3]);
         }
 
-        if (top - glyph->height < b)
-            break;
-
-        glTexCoord2f(s, t);
-        glVertex2i(left, top);
+        if (first || source != pointed || vbo != pointed_vbo)
+        {
+            const Vertex *base = vbo ? 0 : source;
+            if (vbo && !batch->source)
+                base = (const Vertex *) ((const char *) 0 + stream_offset);
+            bind_buffer(vbo);
+            glVertexPointer(2, GL_FLOAT, sizeof(Vertex), &base->x);
+            glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &base->s);
+            glColorPointer(4, GL_FLOAT, sizeof(Vertex), &base->r);
+            pointed = source;
+            pointed_vbo = vbo;
+            first = 0;
+        }
 
-        glTexCoord2f(s + w, t);
-        glVertex2i(left + glyph->width, top);
+        glDrawArrays(modes[state->primitive], batch->first, batch->count);
 
-        glTexCoord2f(s + w, t - h);
-        glVertex2i(left + glyph->width, top - glyph->height);
+        // The current color is undefined after drawing with a color array.
+        if (!state->color)
+            cache.color_known = 0;
+    }
+    PROFILE_GPU_PASS(0);
 
-        glTexCoord2f(s, t - h);
-        glVertex2i(left, top - glyph->height);
+    if (transform)
+        glLoadIdentity();
+}
 
-        left -= glyph->xoffset;
-        top += glyph->yoffset;
-        left += glyph->xadvance;
+// Scissors to the damaged rectangle, and to the board as well for clipped batches.
+static void set_scissor(const DrawRect *rect, int board)
+{
+    int x0 = rect->x0;
+    int y0 = rect->y0;
+    int x1 = rect->x1;
+    int y1 = rect->y1;
 
-        pText++;
-        c++;
+    if (board)
+    {
+        x0 = max(x0, BOARD_LEFT);
+        y0 = max(y0, BOARD_BOTTOM);
+        x1 = min(x1, BOARD_LEFT + BOARD_WIDTH);
+        y1 = min(y1, BOARD_BOTTOM + BOARD_HEIGHT);
     }
-    glEnd();
-    glDisable(GL_TEXTURE_2D);
-    glColor4f(1, 1, 1, 1);
-    glPopMatrix();
+    glScissor(x0 * VIEW_SCALE, y0 * VIEW_SCALE, max(0, x1 - x0) * VIEW_SCALE, max(0, y1 - y0) * VIEW_SCALE);
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-static void draw_tile(float col, float row, unsigned char type)
+static void forget_state()
 {
-    float w = TILE_WIDTH;
-    float h = TILE_HEIGHT;
-    float x = BOARD_LEFT + w * col;
-    float y = TILE_START - h * row;
-
-    glTexCoord2fv(tile_coords[type][0]);
-    glVertex2f(x, y);
-    glTexCoord2fv(tile_coords[type][1]);
-    glVertex2f(x + w, y);
-    glTexCoord2fv(tile_coords[type][2]);
-    glVertex2f(x + w, y + h);
-    glTexCoord2fv(tile_coords[type][3]);
-    glVertex2f(x, y + h);
+    int i;
+    for (i = 0; i < CAP_COUNT; i++)
+        cache.enabled[i] = -1;
+    cache.texture = (GLuint) -1;
+    cache.buffer = (GLuint) -1;
+    cache.color_known = 0;
 }
 
-static void draw_pattern(const unsigned short *pattern, float prow, float col)
+static void set_cap(Cap cap, int enable)
 {
-    float x;
-    float y;
-    for (y = 0; y < 4; y++)
+    if (cache.enabled[cap] == enable)
     {
-        unsigned short row = *pattern++;
-        for (x = 0; x < 4; x++, row <<= 4)
-        {
-            if (row & 0xf000)
-                draw_tile(col + x, prow + y, row >> 12);
-        }
-    }
-}
-
-static void draw_backboard(float mu, int level)
-{    
-    int x = BOARD_LEFT;
-    int y = BOARD_BOTTOM;
-    int w = BOARD_WIDTH;
-    int h = BOARD_HEIGHT;
-
-    if (mu <= 0)
+        cache.elided++;
         return;
+    }
 
-    if (mu < 1)
+    cache.issued++;
+    cache.enabled[cap] = enable;
+    if (cap >= ECapVertexArray)
     {
-        w = (int) (w * mu);
-        h = (int) (h * mu);
+        if (enable)
+            glEnableClientState(caps[cap]);
+        else
+            glDisableClientState(caps[cap]);
     }
-
-    glColor4f(0, 0, 0, 1);
-    outline(x, y, w, h);
-
-    glColor4f(0, 0, 0, 0.5f);
-    glBegin(GL_QUADS);
-    glColor4fv(colors[(GRADIENT_BOTTOM + level) % (GRADIENT_BOTTOM + 1)]);
-    glVertex2i(x, y);
-    glVertex2i(x + w, y);
-    glColor4fv(colors[GRADIENT_TOP]);
-    glVertex2i(x + w, y + h);
-    glVertex2i(x, y + h);
-    glEnd();
-    glColor4f(1, 1, 1, 1);
-}
-
-static GLuint create_texture(int linear)
-{
-    GLuint id;
-    glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
-    if (linear)
+    else if (enable)
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glEnable(caps[cap]);
     }
     else
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glDisable(caps[cap]);
     }
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-    return id;
 }
 
-static void blit(int x, int y, int w, int h, float scale)
+static void bind_texture(GLuint texture)
 {
-    float s = (float) w / npot(w);
-    float t = (float) h / npot(h);
-    float xx = (float) x;
-    float yy = (float) y;
-    float ww = w * scale;
-    float hh = h * scale;
-    glEnable(GL_TEXTURE_2D);
-    glBegin(GL_QUADS);
-    glTexCoord2f(0, 0); glVertex2f(xx, yy);
-    glTexCoord2f(s, 0); glVertex2f(xx + ww, yy);
-    glTexCoord2f(s, t); glVertex2f(xx + ww, yy + hh);
-    glTexCoord2f(0, t); glVertex2f(xx, yy + hh);
-    glEnd();
-    glDisable(GL_TEXTURE_2D);
+    if (cache.texture == texture)
+    {
+        cache.elided++;
+        return;
+    }
+    cache.issued++;
+    cache.texture = texture;
+    glBindTexture(GL_TEXTURE_2D, texture);
 }
 
-static void fill(int x, int y, int w, int h)
+// Without buffer objects everything is drawn from client arrays, as if from buffer 0.
+static void bind_buffer(GLuint buffer)
 {
-    glBegin(GL_QUADS);
-    glVertex2i(x, y);
-    glVertex2i(x + w, y);
-    glVertex2i(x + w, y + h);
-    glVertex2i(x, y + h);
-    glEnd();
+    if (!glBindBuffer)
+        return;
+    if (cache.buffer == buffer)
+    {
+        cache.elided++;
+        return;
+    }
+    cache.issued++;
+    cache.buffer = buffer;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
 }
 
-static void outline(int x, int y, int w, int h)
+static void set_color(float r, float g, float b, float a)
 {
-    const float oa = -1.0f / (VIEW_SCALE * 2);
-    const float ob = +1.0f / (VIEW_SCALE * 2);
-
-    // Shift from pixel boundaries to pixel centers using oa and ob.
-    glBegin(GL_LINE_STRIP);
-    glVertex2f(x + oa, y + oa);
-    glVertex2f(x + w + ob, y + oa);
-    glVertex2f(x + w + ob, y + h + ob);
-    glVertex2f(x + oa, y + h + ob);
-    glVertex2f(x + oa, y + oa);
-    glEnd();
-    glBegin(GL_POINTS);
-    glVertex2f(x + oa, y + oa);
-    glVertex2f(x + w + ob, y + oa);
-    glVertex2f(x + w + ob, y + h + ob);
-    glVertex2f(x + oa, y + h + ob);
-    glEnd();
+    float *color = cache.color;
+
+    if (cache.color_known && color[0] == r && color[1] == g && color[2] == b && color[3] == a)
+    {
+        cache.elided++;
+        return;
+    }
+    cache.issued++;
+    cache.color_known = 1;
+    color[0] = r;
+    color[1] = g;
+    color[2] = b;
+    color[3] = a;
+    glColor4f(r, g, b, a);
 }
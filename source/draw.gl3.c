@@ -0,0 +1,720 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include <stddef.h>
+#include "os.h"
+#include "draw.h"
+#include "image.h"
+#include "profile.h"
+#include "backend.h"
+#include "stream.h"
+#include "GL/gl.h"
+#include "GL/glext.h"
+
+// Renders the draw list through a 3.3 core profile, for drivers where fixed function
+// is slow or emulated.  Build with 'make DRAW=gl3' to link it in place of draw.gl.c;
+// main then asks osInit for a core context.
+//
+// Every quad becomes one instance of a unit quad carrying its rectangle, the texture
+// coordinates of its corners, and its bottom and top colors, which is all that draw.c
+// ever varies across a quad.  The board, the piece, the next pieces and every line of
+// text are each a single instanced draw, and cached geometry is converted once, when it
+// is uploaded.  Lines and points are few, and go through a plain vertex program.
+
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER      0x8B30
+#define GL_VERTEX_SHADER        0x8B31
+#define GL_COMPILE_STATUS       0x8B81
+#define GL_LINK_STATUS          0x8B82
+#endif
+
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS       0x821D
+#endif
+
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER          0x8D40
+#define GL_READ_FRAMEBUFFER     0x8CA8
+#define GL_DRAW_FRAMEBUFFER     0x8CA9
+#define GL_COLOR_ATTACHMENT0    0x8CE0
+#define GL_FRAMEBUFFER_BINDING  0x8CA6
+#endif
+
+// The bundled glext.h predates GL 2.0, so everything this backend needs beyond 1.1 is
+// declared here and loaded through osGetProcAddress.
+#define GL3_FUNCTIONS(F) \
+    F(GLuint, glCreateShader, (GLenum type)) \
+    F(void, glShaderSource, (GLuint shader, GLsizei count, const char **strings, const GLint *lengths)) \
+    F(void, glCompileShader, (GLuint shader)) \
+    F(void, glGetShaderiv, (GLuint shader, GLenum name, GLint *value)) \
+    F(void, glGetShaderInfoLog, (GLuint shader, GLsizei size, GLsizei *length, char *log)) \
+    F(void, glDeleteShader, (GLuint shader)) \
+    F(GLuint, glCreateProgram, ()) \
+    F(void, glAttachShader, (GLuint program, GLuint shader)) \
+    F(void, glLinkProgram, (GLuint program)) \
+    F(void, glGetProgramiv, (GLuint program, GLenum name, GLint *value)) \
+    F(void, glGetProgramInfoLog, (GLuint program, GLsizei size, GLsizei *length, char *log)) \
+    F(void, glDeleteProgram, (GLuint program)) \
+    F(void, glUseProgram, (GLuint program)) \
+    F(GLint, glGetUniformLocation, (GLuint program, const char *name)) \
+    F(void, glUniform1i, (GLint location, GLint value)) \
+    F(void, glUniform4f, (GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w)) \
+    F(void, glGenVertexArrays, (GLsizei count, GLuint *arrays)) \
+    F(void, glBindVertexArray, (GLuint array)) \
+    F(void, glDeleteVertexArrays, (GLsizei count, const GLuint *arrays)) \
+    F(void, glEnableVertexAttribArray, (GLuint index)) \
+    F(void, glDisableVertexAttribArray, (GLuint index)) \
+    F(void, glVertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer)) \
+    F(void, glVertexAttribDivisor, (GLuint index, GLuint divisor)) \
+    F(void, glDrawArraysInstanced, (GLenum mode, GLint first, GLsizei count, GLsizei instances)) \
+    F(void, glGenBuffers, (GLsizei count, GLuint *buffers)) \
+    F(void, glDeleteBuffers, (GLsizei count, const GLuint *buffers)) \
+    F(void, glBindBuffer, (GLenum target, GLuint buffer)) \
+    F(void, glBufferData, (GLenum target, GLsizeiptr size, const void *data, GLenum usage)) \
+    F(void, glCompressedTexImage2D, (GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height, GLint border, GLsizei size, const void *data)) \
+    F(const GLubyte *, glGetStringi, (GLenum name, GLuint index))
+
+#define DECLARE(type, name, params) typedef type (APIENTRY *name##Proc) params; static name##Proc name;
+GL3_FUNCTIONS(DECLARE)
+#undef DECLARE
+
+// One quad: corners 0 and 2 give the rectangle, and 0 and 1 share the bottom color.
+typedef struct
+{
+    float rect[4];
+    float uv[4][2];
+    float bottom[4];
+    float top[4];
+} Instance;
+
+typedef enum
+{
+    EAttribsNone,
+    EAttribsInstances,
+    EAttribsVertices,
+} Attribs;
+
+// Uniforms are per program, so each remembers what it was last given.
+typedef struct
+{
+    GLuint id;
+    GLint pivot;
+    GLint transform;
+    GLint solid;
+    GLint textured;
+    int applied_transform;
+    int applied_color;
+    int applied_textured;
+} Program;
+
+// Enough for a busy frame's instances and vertices; the stream grows if it isn't.
+#define STREAM_CAPACITY (64 * 1024)
+
+static struct
+{
+    Program quads;
+    Program vertices;
+    GLuint vao;
+    Stream stream;
+    int instance_offset;
+    int vertex_offset;
+    Instance *instances;
+    int instance_capacity;
+    int *offsets;
+    int offset_capacity;
+
+    // Which buffer and offset the attributes point at.
+    Attribs attribs;
+    GLuint pointed;
+    int pointed_offset;
+
+    // Read once, as backdrops are decoded off the GL thread.
+    int s3tc;
+} gl3;
+
+static const char *place_source =
+    "#version 330 core\n"
+    "uniform vec4 pivot;\n"
+    "uniform vec4 transform;\n"
+    "uniform vec4 solid;\n"
+    "out vec2 uv;\n"
+    "out vec4 color;\n"
+    "\n"
+    "// Scale and rotate about pivot.xy and move it to pivot.zw, then the same projection as\n"
+    "// glOrtho(0, 480, 0, 320).\n"
+    "vec4 place(vec2 p)\n"
+    "{\n"
+    "    vec2 d = p - pivot.xy;\n"
+    "    p = pivot.zw + vec2(transform.x * d.x - transform.y * d.y, transform.z * d.x + transform.w * d.y);\n"
+    "    return vec4(p * vec2(2.0 / 480.0, 2.0 / 320.0) - 1.0, 0.0, 1.0);\n"
+    "}\n"
+    "\n"
+    "// The solid color replaces the vertex colors; its alpha is negative when there is none.\n"
+    "vec4 paint(vec4 c)\n"
+    "{\n"
+    "    return (solid.a >= 0.0) ? solid : c;\n"
+    "}\n";
+
+// Two triangles per instance, split the way GL_QUADS is.
+static const char *quad_source =
+    "layout(location = 0) in vec4 rect;\n"
+    "layout(location = 1) in vec4 uv01;\n"
+    "layout(location = 2) in vec4 uv23;\n"
+    "layout(location = 3) in vec4 bottom;\n"
+    "layout(location = 4) in vec4 top;\n"
+    "const int corners[6] = int[6](0, 1, 2, 0, 2, 3);\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    int corner = corners[gl_VertexID];\n"
+    "    vec2 p = vec2((corner == 1 || corner == 2) ? rect.z : rect.x, (corner >= 2) ? rect.w : rect.y);\n"
+    "    uv = (corner == 0) ? uv01.xy : (corner == 1) ? uv01.zw : (corner == 2) ? uv23.xy : uv23.zw;\n"
+    "    color = paint((corner >= 2) ? top : bottom);\n"
+    "    gl_Position = place(p);\n"
+    "}\n";
+
+static const char *vertex_source =
+    "layout(location = 0) in vec2 position;\n"
+    "layout(location = 1) in vec2 texcoord;\n"
+    "layout(location = 2) in vec4 vertex_color;\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    uv = texcoord;\n"
+    "    color = paint(vertex_color);\n"
+    "    gl_Position = place(position);\n"
+    "}\n";
+
+// The same as GL_MODULATE.
+static const char *fragment_source =
+    "#version 330 core\n"
+    "uniform sampler2D image;\n"
+    "uniform int textured;\n"
+    "in vec2 uv;\n"
+    "in vec4 color;\n"
+    "out vec4 fragment;\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    fragment = (textured != 0) ? color * texture(image, uv) : color;\n"
+    "}\n";
+
+static GLuint create_texture();
+static void create_program(Program *program, const char *vertex);
+static GLuint compile(GLenum type, const char **sources, int count);
+static int has_extension(const char *name);
+static void to_instances(Instance *dest, const Vertex *v, int count);
+static void prepare(const DrawList *list);
+static void replay(const DrawList *list, const DrawRect *rect);
+static void point_attribs(Attribs attribs, GLuint buffer, int offset);
+static void use_program(const Program *current, Program *program, const DrawList *list, const DrawState *state);
+static void set_scissor(const DrawRect *rect, int board);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void backend_init()
+{
+    int x = BOARD_LEFT * VIEW_SCALE;
+    int y = BOARD_BOTTOM * VIEW_SCALE;
+    int w = BOARD_WIDTH * VIEW_SCALE;
+    int h = BOARD_HEIGHT * VIEW_SCALE;
+
+#define LOAD(type, name, params) \
+    if (!(name = (name##Proc) osGetProcAddress(#name))) \
+        fatalf("Error: couldn't load %s\n", #name);
+    GL3_FUNCTIONS(LOAD)
+#undef LOAD
+
+    memset(&gl3, 0, sizeof(gl3));
+    create_program(&gl3.quads, quad_source);
+    create_program(&gl3.vertices, vertex_source);
+    glGenVertexArrays(1, &gl3.vao);
+    glBindVertexArray(gl3.vao);
+    stream_create(&gl3.stream, STREAM_CAPACITY);
+    gl3.s3tc = has_extension("GL_EXT_texture_compression_s3tc");
+
+    glViewport(0, 0, VIEW_WIDTH, VIEW_HEIGHT);
+    glScissor(x, y, w, h);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    PROFILE_GPU_INIT();
+}
+
+void backend_shutdown()
+{
+    PROFILE_GPU_SHUTDOWN();
+    glUseProgram(0);
+    glDeleteProgram(gl3.quads.id);
+    glDeleteProgram(gl3.vertices.id);
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &gl3.vao);
+    stream_destroy(&gl3.stream);
+    free(gl3.instances);
+    free(gl3.offsets);
+    memset(&gl3, 0, sizeof(gl3));
+}
+
+void backend_resize()
+{
+    const DrawRect view = { 0, 0, BASE_WIDTH, BASE_HEIGHT };
+
+    glViewport(0, 0, VIEW_WIDTH, VIEW_HEIGHT);
+    set_scissor(&view, 1);
+}
+
+int backend_buffer_age()
+{
+    return osBufferAge();
+}
+
+// Core profiles can't allocate a compressed image without data, so with S3TC the
+// backdrop's rows of blocks are copied into a zeroed power-of-two image, uploaded whole.
+unsigned char *backend_decode_backdrop(const char **image)
+{
+    unsigned char *pixels;
+
+    if (gl3.s3tc)
+    {
+        int row = BACKDROP_WIDTH * 2;
+        int pitch = npot(BACKDROP_WIDTH) * 2;
+        unsigned char *blocks = (unsigned char *) malloc(BACKDROP_WIDTH * BACKDROP_HEIGHT / 2 + 1);
+        int y;
+
+        decode(blocks, image);
+        pixels = (unsigned char *) calloc(pitch * npot(BACKDROP_HEIGHT) / 4, 1);
+        for (y = 0; y < BACKDROP_HEIGHT / 4; y++)
+            memcpy(pixels + y * pitch, blocks + y * row, row);
+        free(blocks);
+    }
+    else
+    {
+        pixels = (unsigned char *) malloc(BACKDROP_WIDTH * BACKDROP_HEIGHT * 3);
+        decode_dxt1(BACKDROP_WIDTH, BACKDROP_HEIGHT, pixels, image);
+    }
+    return pixels;
+}
+
+unsigned int backend_backdrop(const unsigned char *pixels)
+{
+    GLuint texture = create_texture();
+
+    if (gl3.s3tc)
+    {
+        int size = npot(BACKDROP_WIDTH) * 2 * npot(BACKDROP_HEIGHT) / 4;
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT), 0, size, pixels);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT), 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BACKDROP_WIDTH, BACKDROP_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    }
+    return texture;
+}
+
+unsigned int backend_texture(int width, int height, const unsigned char *rgba)
+{
+    GLuint texture = create_texture();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    return texture;
+}
+
+void backend_delete_texture(unsigned int texture)
+{
+    glDeleteTextures(1, &texture);
+}
+
+unsigned int backend_buffer()
+{
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    return buffer;
+}
+
+// Cached geometry is always quads, so it is stored as instances.
+void backend_upload(unsigned int buffer, const Vertex *vertices, int count)
+{
+    Instance *instances;
+
+    if (!buffer || !count)
+        return;
+    instances = (Instance *) malloc(count / 4 * sizeof(Instance));
+    to_instances(instances, vertices, count);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, count / 4 * sizeof(Instance), instances, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(instances);
+
+    // The attributes may still point into the old store.
+    gl3.attribs = EAttribsNone;
+}
+
+void backend_delete_buffer(unsigned int buffer)
+{
+    if (buffer)
+        glDeleteBuffers(1, &buffer);
+}
+
+// A partial redraw replays the list once per damaged rectangle, scissored to it, over
+// the previous frame.  That's only left in the back buffer if the OS layer says so;
+// otherwise the whole frame is redrawn.
+void backend_submit(const DrawList *list)
+{
+    static const DrawRect view = { 0, 0, BASE_WIDTH, BASE_HEIGHT };
+    const DrawDamage *damage = list->damage;
+    int i;
+
+    PROFILE_GPU_FRAME();
+    prepare(list);
+
+    if (!damage || damage->full)
+    {
+        if (list->clear)
+            glClear(GL_COLOR_BUFFER_BIT);
+        replay(list, 0);
+        return;
+    }
+
+    glEnable(GL_SCISSOR_TEST);
+    for (i = 0; i < damage->rect_count; i++)
+    {
+        set_scissor(damage->rects + i, 0);
+        if (list->clear)
+            glClear(GL_COLOR_BUFFER_BIT);
+        replay(list, damage->rects + i);
+    }
+    glDisable(GL_SCISSOR_TEST);
+    set_scissor(&view, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static GLuint create_texture()
+{
+    GLuint id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return id;
+}
+
+// Both programs share place_source and fragment_source; the textures are all on unit 0.
+static void create_program(Program *program, const char *vertex)
+{
+    const char *sources[2] = { place_source, vertex };
+    GLuint vs = compile(GL_VERTEX_SHADER, sources, 2);
+    GLuint fs = compile(GL_FRAGMENT_SHADER, &fragment_source, 1);
+    GLint status;
+    char log[1024];
+
+    program->id = glCreateProgram();
+    glAttachShader(program->id, vs);
+    glAttachShader(program->id, fs);
+    glLinkProgram(program->id);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    glGetProgramiv(program->id, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        glGetProgramInfoLog(program->id, sizeof(log), 0, log);
+        fatalf("Error: couldn't link shaders:\n%s\n", log);
+    }
+
+    program->pivot = glGetUniformLocation(program->id, "pivot");
+    program->transform = glGetUniformLocation(program->id, "transform");
+    program->solid = glGetUniformLocation(program->id, "solid");
+    program->textured = glGetUniformLocation(program->id, "textured");
+    glUseProgram(program->id);
+    glUniform1i(glGetUniformLocation(program->id, "image"), 0);
+    glUseProgram(0);
+}
+
+static GLuint compile(GLenum type, const char **sources, int count)
+{
+    GLuint shader = glCreateShader(type);
+    GLint status;
+    char log[1024];
+
+    glShaderSource(shader, count, sources, 0);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        glGetShaderInfoLog(shader, sizeof(log), 0, log);
+        fatalf("Error: couldn't compile shader:\n%s\n", log);
+    }
+    return shader;
+}
+
+static int has_extension(const char *name)
+{
+    GLint count = 0;
+    int i;
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i = 0; i < count; i++)
+    {
+        if (!strcmp((const char *) glGetStringi(GL_EXTENSIONS, i), name))
+            return 1;
+    }
+    return 0;
+}
+
+static void to_instances(Instance *dest, const Vertex *v, int count)
+{
+    int i, j;
+
+    for (i = 0; i + 4 <= count; i += 4, v += 4, dest++)
+    {
+        dest->rect[0] = v[0].x;
+        dest->rect[1] = v[0].y;
+        dest->rect[2] = v[2].x;
+        dest->rect[3] = v[2].y;
+        for (j = 0; j < 4; j++)
+        {
+            dest->uv[j][0] = v[j].s;
+            dest->uv[j][1] = v[j].t;
+        }
+        dest->bottom[0] = v[0].r;
+        dest->bottom[1] = v[0].g;
+        dest->bottom[2] = v[0].b;
+        dest->bottom[3] = v[0].a;
+        dest->top[0] = v[2].r;
+        dest->top[1] = v[2].g;
+        dest->top[2] = v[2].b;
+        dest->top[3] = v[2].a;
+    }
+}
+
+// Converts the quads of every stream batch into instances, noting where each batch's
+// start, and uploads them along with the vertices the lines and points need.
+static void prepare(const DrawList *list)
+{
+    int i, n = 0, vertices = 0;
+
+    if (list->batch_count > gl3.offset_capacity)
+    {
+        gl3.offset_capacity = max(64, 2 * list->batch_count);
+        gl3.offsets = (int *) realloc(gl3.offsets, gl3.offset_capacity * sizeof(int));
+    }
+    if (list->vertex_count / 4 > gl3.instance_capacity)
+    {
+        gl3.instance_capacity = max(256, list->vertex_count / 2);
+        gl3.instances = (Instance *) realloc(gl3.instances, gl3.instance_capacity * sizeof(Instance));
+    }
+
+    for (i = 0; i < list->batch_count; i++)
+    {
+        const DrawBatch *batch = list->batches + i;
+        if (batch->source)
+            continue;
+        if (batch->state.primitive == EPrimQuads)
+        {
+            gl3.offsets[i] = n;
+            to_instances(gl3.instances + n, list->sorted + batch->first, batch->count);
+            n += batch->count / 4;
+        }
+        else if (batch->state.primitive != EPrimCapture)
+        {
+            vertices = list->vertex_count;
+        }
+    }
+
+    // Both go through the one stream, instances first.
+    stream_begin(&gl3.stream, n * sizeof(Instance) + vertices * sizeof(Vertex));
+    if (n)
+        gl3.instance_offset = stream_write(&gl3.stream, gl3.instances, n * sizeof(Instance));
+    if (vertices)
+        gl3.vertex_offset = stream_write(&gl3.stream, list->sorted, vertices * sizeof(Vertex));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gl3.attribs = EAttribsNone;
+}
+
+// Replays the sorted batches, touching GL state only where it differs from the
+// previous batch.  With a rectangle, the scissor test is already on and stays on.
+static void replay(const DrawList *list, const DrawRect *rect)
+{
+    static const GLenum modes[] = { GL_TRIANGLES, GL_LINES, GL_POINTS };
+    const Program *current = 0;
+    DrawState applied;
+    int i;
+
+    if (!list->batch_count)
+        return;
+
+    // The state outside of a submission: untextured, unclipped, blended and untransformed.
+    memset(&applied, 0, sizeof(applied));
+    applied.blend = 1;
+    gl3.quads.applied_transform = gl3.vertices.applied_transform = -1;
+    gl3.quads.applied_color = gl3.vertices.applied_color = -1;
+    gl3.quads.applied_textured = gl3.vertices.applied_textured = -1;
+
+    for (i = 0; i < list->batch_count; i++)
+    {
+        const DrawBatch *batch = list->batches + i;
+        const DrawState *state = &batch->state;
+
+        PROFILE_GPU_PASS(state->pass);
+        if (state->primitive == EPrimCapture)
+        {
+            glBindTexture(GL_TEXTURE_2D, state->texture);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, VIEW_WIDTH, VIEW_HEIGHT);
+            if (applied.texture)
+                glBindTexture(GL_TEXTURE_2D, applied.texture);
+            continue;
+        }
+
+        if (state->texture != applied.texture && state->texture)
+            glBindTexture(GL_TEXTURE_2D, state->texture);
+        if (state->scissor != applied.scissor)
+        {
+            if (rect)
+                set_scissor(rect, state->scissor);
+            else if (state->scissor)
+                glEnable(GL_SCISSOR_TEST);
+            else
+                glDisable(GL_SCISSOR_TEST);
+        }
+        if (state->blend != applied.blend)
+        {
+            if (state->blend)
+                glEnable(GL_BLEND);
+            else
+                glDisable(GL_BLEND);
+        }
+        applied = *state;
+
+        if (state->primitive == EPrimQuads)
+        {
+            use_program(current, &gl3.quads, list, state);
+            current = &gl3.quads;
+            if (batch->source)
+                point_attribs(EAttribsInstances, batch->buffer, batch->first / 4 * sizeof(Instance));
+            else
+                point_attribs(EAttribsInstances, gl3.stream.buffer, gl3.instance_offset + gl3.offsets[i] * sizeof(Instance));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 6, batch->count / 4);
+        }
+        else
+        {
+            use_program(current, &gl3.vertices, list, state);
+            current = &gl3.vertices;
+            point_attribs(EAttribsVertices, gl3.stream.buffer, gl3.vertex_offset);
+            glDrawArrays(modes[state->primitive], batch->first, batch->count);
+        }
+    }
+    PROFILE_GPU_PASS(0);
+
+    if (applied.scissor && !rect)
+        glDisable(GL_SCISSOR_TEST);
+    if (!applied.blend)
+        glEnable(GL_BLEND);
+}
+
+// Instance attributes advance once per instance; there is no base instance in 3.3, so
+// the offset, in bytes, goes into the pointers instead.
+static void point_attribs(Attribs attribs, GLuint buffer, int offset)
+{
+    const char *base = (const char *) 0 + offset;
+    int i;
+
+    if (attribs == gl3.attribs && buffer == gl3.pointed && offset == gl3.pointed_offset)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (attribs == EAttribsInstances)
+    {
+        const GLsizei stride = sizeof(Instance);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, rect));
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, uv[0]));
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, uv[2]));
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, bottom));
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Instance, top));
+        for (i = 0; i < 5; i++)
+        {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+    }
+    else
+    {
+        const GLsizei stride = sizeof(Vertex);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, base + offsetof(Vertex, x));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, base + offsetof(Vertex, s));
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(Vertex, r));
+        for (i = 0; i < 5; i++)
+        {
+            if (i < 3)
+                glEnableVertexAttribArray(i);
+            else
+                glDisableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 0);
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    gl3.attribs = attribs;
+    gl3.pointed = buffer;
+    gl3.pointed_offset = offset;
+}
+
+static void use_program(const Program *current, Program *program, const DrawList *list, const DrawState *state)
+{
+    int textured = state->texture != 0;
+
+    if (current != program)
+        glUseProgram(program->id);
+    if (program->applied_transform != state->transform)
+    {
+        const DrawTransform *transform = list->transforms + state->transform;
+        float radians = transform->angle * 3.14159265f / 180;
+        if (state->transform)
+        {
+            glUniform4f(program->pivot, transform->x, transform->y, transform->x + transform->offset[0], transform->y + transform->offset[1]);
+            glUniform4f(program->transform,
+                cosf(radians) * transform->scale[0], sinf(radians) * transform->scale[1],
+                sinf(radians) * transform->scale[0], cosf(radians) * transform->scale[1]);
+        }
+        else
+        {
+            glUniform4f(program->pivot, 0, 0, 0, 0);
+            glUniform4f(program->transform, 1, 0, 0, 1);
+        }
+        program->applied_transform = state->transform;
+    }
+    if (program->applied_color != state->color)
+    {
+        const float *color = list->colors[state->color];
+        if (state->color)
+            glUniform4f(program->solid, color[0], color[1], color[2], color[3]);
+        else
+            glUniform4f(program->solid, 0, 0, 0, -1);
+        program->applied_color = state->color;
+    }
+    if (program->applied_textured != textured)
+    {
+        glUniform1i(program->textured, textured);
+        program->applied_textured = textured;
+    }
+}
+
+// Scissors to the damaged rectangle, and to the board as well for clipped batches.
+static void set_scissor(const DrawRect *rect, int board)
+{
+    int x0 = rect->x0;
+    int y0 = rect->y0;
+    int x1 = rect->x1;
+    int y1 = rect->y1;
+
+    if (board)
+    {
+        x0 = max(x0, BOARD_LEFT);
+        y0 = max(y0, BOARD_BOTTOM);
+        x1 = min(x1, BOARD_LEFT + BOARD_WIDTH);
+        y1 = min(y1, BOARD_BOTTOM + BOARD_HEIGHT);
+    }
+    glScissor(x0 * VIEW_SCALE, y0 * VIEW_SCALE, max(0, x1 - x0) * VIEW_SCALE, max(0, y1 - y0) * VIEW_SCALE);
+}
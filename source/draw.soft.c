@@ -0,0 +1,565 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "draw.h"
+#include "image.h"
+#include "backend.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Renders the draw list on the CPU into an RGBA framebuffer, bottom row first like
+// GL, and hands it to osPresent.  Build with 'make DRAW=soft' to link it in place of
+// draw.gl.c.
+//
+// Coverage and sampling follow GL's rules closely enough to pass for it: quads cover
+// the pixels whose centers they contain, textures are sampled nearest with clamping,
+// and lines are one pixel wide.
+
+#define TEXTURE_CAPACITY (BASIL_COUNT + 4)
+
+typedef struct
+{
+    int width, height;
+    unsigned int *texels;
+} Texture;
+
+// Everything a primitive needs from its batch's state.
+typedef struct
+{
+    const Texture *texture;
+    const DrawTransform *transform;
+    const float *color;
+    int clip[4];
+    int blend;
+} Raster;
+
+static struct
+{
+    unsigned char *pixels;
+    Texture textures[TEXTURE_CAPACITY];
+    int *columns;
+} soft;
+
+static unsigned int add_texture(int width, int height);
+static void render(const DrawList *list, const int *bounds);
+static void to_pixels(const Raster *raster, const Vertex *v, Vertex *p, int count);
+static int is_rect(const Vertex *p);
+static void fill_rect(const Raster *raster, const Vertex *p);
+static void fill_triangle(const Raster *raster, const Vertex *a, const Vertex *b, const Vertex *c);
+static void draw_line(const Raster *raster, const Vertex *a, const Vertex *b);
+static void draw_point(const Raster *raster, const Vertex *v);
+static void capture(Texture *texture);
+static void to_color(unsigned char *color, float r, float g, float b, float a);
+static const unsigned char *sample(const Texture *texture, float s, float t);
+static void shade(unsigned char *dst, const unsigned char *texel, const unsigned char *color, int blend);
+static void shade_span(unsigned char *dst, const unsigned int *row, const int *columns, int count, const unsigned char *color, int blend);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void backend_init()
+{
+    soft.pixels = (unsigned char *) calloc(4 * VIEW_WIDTH * VIEW_HEIGHT, 1);
+    soft.columns = (int *) malloc(VIEW_WIDTH * sizeof(int));
+    memset(soft.textures, 0, sizeof(soft.textures));
+}
+
+void backend_shutdown()
+{
+    int i;
+    for (i = 0; i < TEXTURE_CAPACITY; i++)
+        free(soft.textures[i].texels);
+    memset(soft.textures, 0, sizeof(soft.textures));
+    free(soft.pixels);
+    free(soft.columns);
+    soft.pixels = 0;
+    soft.columns = 0;
+}
+
+// The next submit repaints everything, so the old pixels needn't be kept.
+void backend_resize()
+{
+    free(soft.pixels);
+    free(soft.columns);
+    soft.pixels = (unsigned char *) calloc(4 * VIEW_WIDTH * VIEW_HEIGHT, 1);
+    soft.columns = (int *) malloc(VIEW_WIDTH * sizeof(int));
+}
+
+// There is only the one framebuffer, and it always holds the last frame.
+int backend_buffer_age()
+{
+    return 1;
+}
+
+unsigned char *backend_decode_backdrop(const char **image)
+{
+    unsigned char *rgb = (unsigned char *) malloc(BACKDROP_WIDTH * BACKDROP_HEIGHT * 3);
+    decode_dxt1(BACKDROP_WIDTH, BACKDROP_HEIGHT, rgb, image);
+    return rgb;
+}
+
+// Stored at the same power-of-two size as the GL texture, so the texture coordinates match.
+unsigned int backend_backdrop(const unsigned char *rgb)
+{
+    unsigned int handle = add_texture(npot(BACKDROP_WIDTH), npot(BACKDROP_HEIGHT));
+    Texture *texture = soft.textures + handle - 1;
+    int x, y;
+
+    for (y = 0; y < BACKDROP_HEIGHT; y++)
+    {
+        const unsigned char *src = rgb + 3 * y * BACKDROP_WIDTH;
+        unsigned char *dest = (unsigned char *) (texture->texels + y * texture->width);
+        for (x = 0; x < BACKDROP_WIDTH; x++, src += 3, dest += 4)
+        {
+            dest[0] = src[0];
+            dest[1] = src[1];
+            dest[2] = src[2];
+            dest[3] = 255;
+        }
+    }
+    return handle;
+}
+
+unsigned int backend_texture(int width, int height, const unsigned char *rgba)
+{
+    unsigned int handle = add_texture(width, height);
+    if (rgba)
+        memcpy(soft.textures[handle - 1].texels, rgba, 4 * width * height);
+    return handle;
+}
+
+void backend_delete_texture(unsigned int texture)
+{
+    if (!texture)
+        return;
+    free(soft.textures[texture - 1].texels);
+    memset(soft.textures + texture - 1, 0, sizeof(Texture));
+}
+
+// Cached geometry is drawn straight from the client copy.
+unsigned int backend_buffer()
+{
+    return 0;
+}
+
+void backend_upload(unsigned int buffer, const Vertex *vertices, int count)
+{
+}
+
+void backend_delete_buffer(unsigned int buffer)
+{
+}
+
+// The framebuffer persists between frames, so a partial redraw only has to render each
+// damaged rectangle.
+void backend_submit(const DrawList *list)
+{
+    const DrawDamage *damage = list->damage;
+    int bounds[4] = { 0, 0, VIEW_WIDTH, VIEW_HEIGHT };
+    int i;
+
+    if (!damage)
+        render(list, bounds);
+
+    for (i = 0; damage && i < damage->rect_count; i++)
+    {
+        bounds[0] = damage->rects[i].x0 * VIEW_SCALE;
+        bounds[1] = damage->rects[i].y0 * VIEW_SCALE;
+        bounds[2] = damage->rects[i].x1 * VIEW_SCALE;
+        bounds[3] = damage->rects[i].y1 * VIEW_SCALE;
+        render(list, bounds);
+    }
+
+    osPresent(soft.pixels, VIEW_WIDTH, VIEW_HEIGHT);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned int add_texture(int width, int height)
+{
+    int i;
+    for (i = 0; i < TEXTURE_CAPACITY; i++)
+    {
+        Texture *texture = soft.textures + i;
+        if (!texture->texels)
+        {
+            texture->width = width;
+            texture->height = height;
+            texture->texels = (unsigned int *) calloc(width * height, 4);
+            return i + 1;
+        }
+    }
+    fatalf("Error: out of software textures\n");
+    return 0;
+}
+
+// Draws the list with everything clipped to bounds, given in pixels.
+static void render(const DrawList *list, const int *bounds)
+{
+    Raster raster;
+    Vertex p[4];
+    int i, j;
+
+    if (list->clear)
+    {
+        for (i = bounds[1]; i < bounds[3]; i++)
+            memset(soft.pixels + 4 * (i * VIEW_WIDTH + bounds[0]), 0, 4 * (bounds[2] - bounds[0]));
+    }
+
+    for (i = 0; i < list->batch_count; i++)
+    {
+        const DrawBatch *batch = list->batches + i;
+        const DrawState *state = &batch->state;
+        const Vertex *v = (batch->source ? batch->source : list->sorted) + batch->first;
+
+        raster.texture = state->texture ? soft.textures + state->texture - 1 : 0;
+        raster.transform = state->transform ? list->transforms + state->transform : 0;
+        raster.color = state->color ? list->colors[state->color] : 0;
+        raster.blend = state->blend;
+        memcpy(raster.clip, bounds, sizeof(raster.clip));
+        if (state->scissor)
+        {
+            raster.clip[0] = max(raster.clip[0], BOARD_LEFT * VIEW_SCALE);
+            raster.clip[1] = max(raster.clip[1], BOARD_BOTTOM * VIEW_SCALE);
+            raster.clip[2] = min(raster.clip[2], (BOARD_LEFT + BOARD_WIDTH) * VIEW_SCALE);
+            raster.clip[3] = min(raster.clip[3], (BOARD_BOTTOM + BOARD_HEIGHT) * VIEW_SCALE);
+        }
+
+        switch (state->primitive)
+        {
+            case EPrimQuads:
+                for (j = 0; j + 4 <= batch->count; j += 4)
+                {
+                    to_pixels(&raster, v + j, p, 4);
+                    if (is_rect(p))
+                    {
+                        fill_rect(&raster, p);
+                    }
+                    else
+                    {
+                        fill_triangle(&raster, p + 0, p + 1, p + 2);
+                        fill_triangle(&raster, p + 0, p + 2, p + 3);
+                    }
+                }
+                break;
+
+            case EPrimLines:
+                for (j = 0; j + 2 <= batch->count; j += 2)
+                {
+                    to_pixels(&raster, v + j, p, 2);
+                    draw_line(&raster, p + 0, p + 1);
+                }
+                break;
+
+            case EPrimPoints:
+                for (j = 0; j < batch->count; j++)
+                {
+                    to_pixels(&raster, v + j, p, 1);
+                    draw_point(&raster, p);
+                }
+                break;
+
+            case EPrimCapture:
+                capture(soft.textures + state->texture - 1);
+                break;
+        }
+    }
+}
+
+// Applies the batch's transform and color, and maps view coordinates onto the framebuffer.
+static void to_pixels(const Raster *raster, const Vertex *v, Vertex *p, int count)
+{
+    const DrawTransform *transform = raster->transform;
+    float m[4] = { 1, 0, 0, 1 };
+    int i;
+
+    if (transform)
+    {
+        float radians = transform->angle * 3.14159265f / 180;
+        m[0] = cosf(radians) * transform->scale[0];
+        m[1] = sinf(radians) * transform->scale[1];
+        m[2] = sinf(radians) * transform->scale[0];
+        m[3] = cosf(radians) * transform->scale[1];
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        p[i] = v[i];
+        if (transform)
+        {
+            float dx = v[i].x - transform->x;
+            float dy = v[i].y - transform->y;
+            p[i].x = transform->x + transform->offset[0] + m[0] * dx - m[1] * dy;
+            p[i].y = transform->y + transform->offset[1] + m[2] * dx + m[3] * dy;
+        }
+        if (raster->color)
+            memcpy(&p[i].r, raster->color, 4 * sizeof(float));
+        p[i].x *= VIEW_SCALE;
+        p[i].y *= VIEW_SCALE;
+    }
+}
+
+// Quads in the order emitted by draw.c, with texture coordinates and colors that vary
+// along only one axis each, can be filled a span at a time.
+static int is_rect(const Vertex *p)
+{
+    return p[0].y == p[1].y && p[2].y == p[3].y && p[0].x == p[3].x && p[1].x == p[2].x &&
+        p[0].s == p[3].s && p[1].s == p[2].s && p[0].t == p[1].t && p[2].t == p[3].t &&
+        p[0].r == p[1].r && p[0].g == p[1].g && p[0].b == p[1].b && p[0].a == p[1].a &&
+        p[2].r == p[3].r && p[2].g == p[3].g && p[2].b == p[3].b && p[2].a == p[3].a;
+}
+
+static void fill_rect(const Raster *raster, const Vertex *p)
+{
+    const Texture *texture = raster->texture;
+    const Vertex *left = (p[0].x <= p[1].x) ? p + 0 : p + 1;
+    const Vertex *right = (p[0].x <= p[1].x) ? p + 1 : p + 0;
+    const Vertex *bottom = (p[0].y <= p[3].y) ? p + 0 : p + 3;
+    const Vertex *top = (p[0].y <= p[3].y) ? p + 3 : p + 0;
+    int x0 = max(raster->clip[0], (int) ceilf(left->x - 0.5f));
+    int x1 = min(raster->clip[2], (int) ceilf(right->x - 0.5f));
+    int y0 = max(raster->clip[1], (int) ceilf(bottom->y - 0.5f));
+    int y1 = min(raster->clip[3], (int) ceilf(top->y - 0.5f));
+    int gradient = bottom->r != top->r || bottom->g != top->g || bottom->b != top->b || bottom->a != top->a;
+    float dy = top->y - bottom->y;
+    unsigned char color[4];
+    int x, y;
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (texture)
+    {
+        float ds = (right->s - left->s) / (right->x - left->x);
+        for (x = x0; x < x1; x++)
+        {
+            float s = left->s + (x + 0.5f - left->x) * ds;
+            soft.columns[x - x0] = min(texture->width - 1, max(0, (int) floorf(s * texture->width)));
+        }
+    }
+
+    to_color(color, bottom->r, bottom->g, bottom->b, bottom->a);
+    for (y = y0; y < y1; y++)
+    {
+        float mu = (y + 0.5f - bottom->y) / dy;
+        const unsigned int *row = 0;
+
+        if (gradient)
+        {
+            to_color(color,
+                bottom->r + mu * (top->r - bottom->r),
+                bottom->g + mu * (top->g - bottom->g),
+                bottom->b + mu * (top->b - bottom->b),
+                bottom->a + mu * (top->a - bottom->a));
+        }
+        if (texture)
+        {
+            float t = bottom->t + mu * (top->t - bottom->t);
+            int v = min(texture->height - 1, max(0, (int) floorf(t * texture->height)));
+            row = texture->texels + v * texture->width;
+        }
+
+        shade_span(soft.pixels + 4 * (y * VIEW_WIDTH + x0), row, soft.columns, x1 - x0, color, raster->blend);
+    }
+}
+
+// Edge functions with a top-left fill rule, interpolating every attribute; only the
+// rotating next pieces come through here, so it does not need to be fast.
+static void fill_triangle(const Raster *raster, const Vertex *a, const Vertex *b, const Vertex *c)
+{
+    float area = (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+    float minx, miny, maxx, maxy;
+    int x0, y0, x1, y1, x, y;
+
+    if (area == 0)
+        return;
+    if (area < 0)
+    {
+        const Vertex *swap = b;
+        b = c;
+        c = swap;
+        area = -area;
+    }
+
+    minx = min(a->x, min(b->x, c->x));
+    miny = min(a->y, min(b->y, c->y));
+    maxx = max(a->x, max(b->x, c->x));
+    maxy = max(a->y, max(b->y, c->y));
+    x0 = max(raster->clip[0], (int) ceilf(minx - 0.5f));
+    y0 = max(raster->clip[1], (int) ceilf(miny - 0.5f));
+    x1 = min(raster->clip[2], (int) ceilf(maxx - 0.5f));
+    y1 = min(raster->clip[3], (int) ceilf(maxy - 0.5f));
+
+    for (y = y0; y < y1; y++)
+    {
+        for (x = x0; x < x1; x++)
+        {
+            float px = x + 0.5f;
+            float py = y + 0.5f;
+            float w0 = (c->x - b->x) * (py - b->y) - (c->y - b->y) * (px - b->x);
+            float w1 = (a->x - c->x) * (py - c->y) - (a->y - c->y) * (px - c->x);
+            float w2 = (b->x - a->x) * (py - a->y) - (b->y - a->y) * (px - a->x);
+            const unsigned char *texel = 0;
+            unsigned char color[4];
+
+            // Pixels exactly on an edge belong to the triangle on its left or top.
+            if (w0 < 0 || w1 < 0 || w2 < 0)
+                continue;
+            if ((w0 == 0 && (c->y > b->y || (c->y == b->y && c->x > b->x))) ||
+                (w1 == 0 && (a->y > c->y || (a->y == c->y && a->x > c->x))) ||
+                (w2 == 0 && (b->y > a->y || (b->y == a->y && b->x > a->x))))
+                continue;
+
+            w0 /= area;
+            w1 /= area;
+            w2 /= area;
+            to_color(color,
+                w0 * a->r + w1 * b->r + w2 * c->r,
+                w0 * a->g + w1 * b->g + w2 * c->g,
+                w0 * a->b + w1 * b->b + w2 * c->b,
+                w0 * a->a + w1 * b->a + w2 * c->a);
+            if (raster->texture)
+                texel = sample(raster->texture, w0 * a->s + w1 * b->s + w2 * c->s, w0 * a->t + w1 * b->t + w2 * c->t);
+            shade(soft.pixels + 4 * (y * VIEW_WIDTH + x), texel, color, raster->blend);
+        }
+    }
+}
+
+// Steps along the major axis one pixel center at a time, like GL's diamond-exit rule
+// for axis-aligned lines.
+static void draw_line(const Raster *raster, const Vertex *a, const Vertex *b)
+{
+    float dx = b->x - a->x;
+    float dy = b->y - a->y;
+    int major = fabsf(dx) >= fabsf(dy) ? 0 : 1;
+    float from = major ? min(a->y, b->y) : min(a->x, b->x);
+    float to = major ? max(a->y, b->y) : max(a->x, b->x);
+    int i, first = (int) ceilf(from - 0.5f), last = (int) ceilf(to - 0.5f);
+    unsigned char color[4];
+
+    for (i = first; i < last; i++)
+    {
+        float mu = major ? (i + 0.5f - a->y) / dy : (i + 0.5f - a->x) / dx;
+        int x = major ? (int) floorf(a->x + mu * dx) : i;
+        int y = major ? i : (int) floorf(a->y + mu * dy);
+
+        if (x < raster->clip[0] || x >= raster->clip[2] || y < raster->clip[1] || y >= raster->clip[3])
+            continue;
+        to_color(color, a->r + mu * (b->r - a->r), a->g + mu * (b->g - a->g), a->b + mu * (b->b - a->b), a->a + mu * (b->a - a->a));
+        shade(soft.pixels + 4 * (y * VIEW_WIDTH + x), raster->texture ? sample(raster->texture, a->s, a->t) : 0, color, raster->blend);
+    }
+}
+
+static void draw_point(const Raster *raster, const Vertex *v)
+{
+    int x = (int) floorf(v->x);
+    int y = (int) floorf(v->y);
+    unsigned char color[4];
+
+    if (x < raster->clip[0] || x >= raster->clip[2] || y < raster->clip[1] || y >= raster->clip[3])
+        return;
+    to_color(color, v->r, v->g, v->b, v->a);
+    shade(soft.pixels + 4 * (y * VIEW_WIDTH + x), raster->texture ? sample(raster->texture, v->s, v->t) : 0, color, raster->blend);
+}
+
+static void capture(Texture *texture)
+{
+    int width = min(texture->width, VIEW_WIDTH);
+    int height = min(texture->height, VIEW_HEIGHT);
+    int y;
+
+    for (y = 0; y < height; y++)
+        memcpy(texture->texels + y * texture->width, soft.pixels + 4 * y * VIEW_WIDTH, 4 * width);
+}
+
+static void to_color(unsigned char *color, float r, float g, float b, float a)
+{
+    color[0] = (unsigned char) (clamp(r) * 255 + 0.5f);
+    color[1] = (unsigned char) (clamp(g) * 255 + 0.5f);
+    color[2] = (unsigned char) (clamp(b) * 255 + 0.5f);
+    color[3] = (unsigned char) (clamp(a) * 255 + 0.5f);
+}
+
+static const unsigned char *sample(const Texture *texture, float s, float t)
+{
+    int u = min(texture->width - 1, max(0, (int) floorf(s * texture->width)));
+    int v = min(texture->height - 1, max(0, (int) floorf(t * texture->height)));
+    return (const unsigned char *) (texture->texels + v * texture->width + u);
+}
+
+// x / 255, correctly rounded for any product of two bytes.
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+// Modulates the texel by the color, then blends with SRC_ALPHA, ONE_MINUS_SRC_ALPHA.
+static void shade(unsigned char *dst, const unsigned char *texel, const unsigned char *color, int blend)
+{
+    unsigned char src[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        src[i] = texel ? (unsigned char) DIV255(texel[i] * color[i]) : color[i];
+
+    if (!blend)
+    {
+        memcpy(dst, src, 4);
+        return;
+    }
+
+    for (i = 0; i < 4; i++)
+        dst[i] = (unsigned char) DIV255(src[i] * src[3] + dst[i] * (255 - src[3]));
+}
+
+#ifdef __SSE2__
+
+static inline __m128i div255_epi16(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Two pixels as 16-bit channels.
+static inline __m128i blend_epi16(__m128i src, __m128i dst)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    return div255_epi16(_mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dst, inverse)));
+}
+
+#endif
+
+// A row of pixels sharing one color, sampling row[columns[i]] when textured.  SSE2
+// shades four pixels at a time with 16-bit channels.
+static void shade_span(unsigned char *dst, const unsigned int *row, const int *columns, int count, const unsigned char *color, int blend)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i tint = _mm_set_epi16(color[3], color[2], color[1], color[0], color[3], color[2], color[1], color[0]);
+
+    for (; i + 4 <= count; i += 4, dst += 16)
+    {
+        __m128i lo = tint;
+        __m128i hi = tint;
+
+        if (row)
+        {
+            __m128i texels = _mm_set_epi32(row[columns[i + 3]], row[columns[i + 2]], row[columns[i + 1]], row[columns[i]]);
+            lo = div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(texels, zero), tint));
+            hi = div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(texels, zero), tint));
+        }
+        if (blend)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i *) dst);
+            lo = blend_epi16(lo, _mm_unpacklo_epi8(pixels, zero));
+            hi = blend_epi16(hi, _mm_unpackhi_epi8(pixels, zero));
+        }
+        _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++, dst += 4)
+        shade(dst, row ? (const unsigned char *) (row + columns[i]) : 0, color, blend);
+}
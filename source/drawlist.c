@@ -0,0 +1,463 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "drawlist.h"
+
+static int same_state(const DrawState *a, const DrawState *b);
+static void command_bounds(const DrawList *list, DrawCommand *command);
+static int overlaps(const float *a, const float *b);
+static void *grow(void *data, int *capacity, int needed, int size);
+static DrawCommand *add_command(DrawList *list, const DrawState *state);
+static void primitive_bounds(const DrawList *list, const DrawState *state, const Vertex *v, int count, float *b);
+static void merge_damage(DrawDamage *damage);
+static unsigned int hash(unsigned int seed, const void *data, int size);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void drawlist_create(DrawList *list)
+{
+    memset(list, 0, sizeof(DrawList));
+    list->transform_count = 1;
+    list->color_count = 1;
+}
+
+void drawlist_destroy(DrawList *list)
+{
+    free(list->vertices);
+    free(list->commands);
+    free(list->sorted);
+    free(list->batches);
+    memset(list, 0, sizeof(DrawList));
+}
+
+void drawlist_reset(DrawList *list)
+{
+    list->vertex_count = 0;
+    list->command_count = 0;
+    list->transform_count = 1;
+    list->color_count = 1;
+    list->batch_count = 0;
+    list->clear = 0;
+    list->damage = 0;
+}
+
+void drawlist_clear(DrawList *list)
+{
+    list->clear = 1;
+}
+
+Vertex *drawlist_append(DrawList *list, const DrawState *state, int count)
+{
+    DrawCommand *last = list->command_count ? list->commands + list->command_count - 1 : 0;
+    Vertex *v;
+
+    list->vertices = (Vertex *) grow(list->vertices, &list->vertex_capacity, list->vertex_count + count, sizeof(Vertex));
+
+    // Consecutive geometry with the same state simply extends the previous command.
+    if (last && !last->source && same_state(&last->state, state))
+    {
+        last->count += count;
+    }
+    else
+    {
+        DrawCommand *command = add_command(list, state);
+        command->first = list->vertex_count;
+        command->count = count;
+    }
+
+    v = list->vertices + list->vertex_count;
+    list->vertex_count += count;
+    return v;
+}
+
+void drawlist_cached(DrawList *list, const DrawState *state, const Vertex *source, unsigned int buffer, int first, int count)
+{
+    DrawCommand *command;
+
+    if (!count)
+        return;
+
+    command = add_command(list, state);
+    command->source = source;
+    command->buffer = buffer;
+    command->first = first;
+    command->count = count;
+}
+
+void drawlist_capture(DrawList *list, unsigned int texture)
+{
+    DrawState state;
+
+    memset(&state, 0, sizeof(state));
+    state.primitive = EPrimCapture;
+    state.texture = texture;
+    add_command(list, &state)->count = 0;
+}
+
+int drawlist_transform(DrawList *list, const DrawTransform *transform)
+{
+    assert(list->transform_count < DRAW_TRANSFORM_CAPACITY);
+    list->transforms[list->transform_count] = *transform;
+    return list->transform_count++;
+}
+
+int drawlist_color(DrawList *list, float r, float g, float b, float a)
+{
+    float *color;
+
+    assert(list->color_count < DRAW_COLOR_CAPACITY);
+    color = list->colors[list->color_count];
+    color[0] = r;
+    color[1] = g;
+    color[2] = b;
+    color[3] = a;
+    return list->color_count++;
+}
+
+// Each command joins the latest batch with the same state, unless it would have to
+// move past a batch it overlaps; blending makes the order of overlapping geometry
+// significant, but disjoint geometry can be drawn in any order.
+void drawlist_sort(DrawList *list)
+{
+    int *heads, *tails;
+    float (*bounds)[4];
+    int i, j, n;
+
+    list->batch_count = 0;
+    if (!list->command_count)
+        return;
+
+    list->batches = (DrawBatch *) grow(list->batches, &list->batch_capacity, list->command_count, sizeof(DrawBatch));
+    list->sorted = (Vertex *) grow(list->sorted, &list->sorted_capacity, list->vertex_count, sizeof(Vertex));
+    heads = (int *) malloc(list->command_count * sizeof(int));
+    tails = (int *) malloc(list->command_count * sizeof(int));
+    bounds = (float (*)[4]) malloc(list->command_count * sizeof(float[4]));
+
+    for (i = 0; i < list->command_count; i++)
+    {
+        DrawCommand *command = list->commands + i;
+        int target = -1;
+
+        command_bounds(list, command);
+        command->next = -1;
+
+        for (j = list->batch_count - 1; j >= 0 && !command->source && command->state.primitive != EPrimCapture; j--)
+        {
+            if (!list->batches[j].source && same_state(&list->batches[j].state, &command->state))
+            {
+                target = j;
+                break;
+            }
+            if (overlaps(bounds[j], command->bounds))
+                break;
+        }
+
+        if (target < 0)
+        {
+            DrawBatch *batch = list->batches + list->batch_count;
+            batch->state = command->state;
+            batch->source = command->source;
+            batch->buffer = command->buffer;
+            target = list->batch_count++;
+            heads[target] = i;
+            memcpy(bounds[target], command->bounds, sizeof(bounds[target]));
+        }
+        else
+        {
+            list->commands[tails[target]].next = i;
+            bounds[target][0] = min(bounds[target][0], command->bounds[0]);
+            bounds[target][1] = min(bounds[target][1], command->bounds[1]);
+            bounds[target][2] = max(bounds[target][2], command->bounds[2]);
+            bounds[target][3] = max(bounds[target][3], command->bounds[3]);
+        }
+        tails[target] = i;
+    }
+
+    // Gather each batch's stream geometry into one contiguous range.
+    for (i = 0, n = 0; i < list->batch_count; i++)
+    {
+        DrawBatch *batch = list->batches + i;
+        if (batch->source)
+        {
+            batch->first = list->commands[heads[i]].first;
+            batch->count = list->commands[heads[i]].count;
+            continue;
+        }
+        batch->first = n;
+        for (j = heads[i]; j >= 0; j = list->commands[j].next)
+        {
+            const DrawCommand *command = list->commands + j;
+            memcpy(list->sorted + n, list->vertices + command->first, command->count * sizeof(Vertex));
+            n += command->count;
+        }
+        batch->count = n - batch->first;
+    }
+
+    free(heads);
+    free(tails);
+    free(bounds);
+}
+
+void drawlist_damage_create(DrawDamage *damage, int width, int height)
+{
+    memset(damage, 0, sizeof(DrawDamage));
+    damage->width = width;
+    damage->height = height;
+    damage->cols = (width + DRAW_DAMAGE_CELL - 1) / DRAW_DAMAGE_CELL;
+    damage->rows = (height + DRAW_DAMAGE_CELL - 1) / DRAW_DAMAGE_CELL;
+    damage->cells = (unsigned int *) calloc(damage->cols * damage->rows, sizeof(unsigned int));
+    damage->previous = (unsigned int *) calloc(damage->cols * damage->rows, sizeof(unsigned int));
+}
+
+void drawlist_damage_destroy(DrawDamage *damage)
+{
+    free(damage->cells);
+    free(damage->previous);
+    memset(damage, 0, sizeof(DrawDamage));
+}
+
+// Hashes the frame into the grid and compares it with the previous frame.  Frames that
+// don't start with a clear, or that capture the framebuffer, have to be drawn in full.
+void drawlist_damage(DrawList *list, DrawDamage *damage)
+{
+    static const int sizes[] = { 4, 2, 1, 0 };
+    const int count = damage->cols * damage->rows;
+    unsigned int *swap;
+    int i, j, x, y;
+
+    damage->full = !damage->valid || !list->clear;
+    for (i = 0; i < count; i++)
+        damage->cells[i] = 2166136261u;
+
+    for (i = 0; i < list->command_count; i++)
+    {
+        const DrawCommand *command = list->commands + i;
+        const DrawState *state = &command->state;
+        const Vertex *v = (command->source ? command->source : list->vertices) + command->first;
+        const int size = sizes[state->primitive];
+        unsigned int key[5];
+
+        if (state->primitive == EPrimCapture)
+        {
+            damage->full = 1;
+            continue;
+        }
+
+        // The state's padding is uninitialized, so hash its fields rather than its bytes.
+        key[0] = state->primitive;
+        key[1] = state->texture;
+        key[2] = state->scissor | state->blend << 1;
+        key[3] = hash(0, list->transforms + state->transform, sizeof(DrawTransform));
+        key[4] = hash(0, list->colors[state->color], sizeof(list->colors[0]));
+
+        for (j = 0; j + size <= command->count; j += size)
+        {
+            unsigned int h = hash(hash(2166136261u, key, sizeof(key)), v + j, size * sizeof(Vertex));
+            float b[4];
+            int x0, y0, x1, y1;
+
+            primitive_bounds(list, state, v + j, size, b);
+            if (b[2] < 0 || b[3] < 0 || b[0] >= damage->width || b[1] >= damage->height)
+                continue;
+
+            x0 = max(0, (int) b[0] / DRAW_DAMAGE_CELL);
+            y0 = max(0, (int) b[1] / DRAW_DAMAGE_CELL);
+            x1 = min(damage->cols - 1, (int) b[2] / DRAW_DAMAGE_CELL);
+            y1 = min(damage->rows - 1, (int) b[3] / DRAW_DAMAGE_CELL);
+            for (y = y0; y <= y1; y++)
+            {
+                unsigned int *cell = damage->cells + y * damage->cols + x0;
+                for (x = x0; x <= x1; x++, cell++)
+                    *cell = (*cell ^ h) * 16777619u;
+            }
+        }
+    }
+
+    merge_damage(damage);
+    if (damage->full)
+    {
+        damage->rect_count = 1;
+        damage->rects[0].x0 = 0;
+        damage->rects[0].y0 = 0;
+        damage->rects[0].x1 = damage->width;
+        damage->rects[0].y1 = damage->height;
+    }
+
+    swap = damage->previous;
+    damage->previous = damage->cells;
+    damage->cells = swap;
+    damage->valid = 1;
+    list->damage = damage;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int same_state(const DrawState *a, const DrawState *b)
+{
+    return a->primitive == b->primitive &&
+        a->texture == b->texture &&
+        a->scissor == b->scissor &&
+        a->blend == b->blend &&
+        a->transform == b->transform &&
+        a->color == b->color &&
+        a->pass == b->pass;
+}
+
+static void command_bounds(const DrawList *list, DrawCommand *command)
+{
+    const Vertex *v = command->source ? command->source : list->vertices;
+    float *b = command->bounds;
+    float pad;
+    int i;
+
+    // Transformed geometry and captures are never moved; give them bounds that overlap everything.
+    if (command->state.transform || command->state.primitive == EPrimCapture)
+    {
+        b[0] = b[1] = -1e30f;
+        b[2] = b[3] = 1e30f;
+        return;
+    }
+
+    v += command->first;
+    b[0] = b[2] = v->x;
+    b[1] = b[3] = v->y;
+    for (i = 1; i < command->count; i++)
+    {
+        b[0] = min(b[0], v[i].x);
+        b[1] = min(b[1], v[i].y);
+        b[2] = max(b[2], v[i].x);
+        b[3] = max(b[3], v[i].y);
+    }
+
+    // Lines and points cover pixels beyond their vertices.
+    pad = (command->state.primitive == EPrimQuads) ? 0.0f : 1.0f;
+    b[0] -= pad;
+    b[1] -= pad;
+    b[2] += pad;
+    b[3] += pad;
+}
+
+// Quads that merely share an edge do not share any pixels.
+static int overlaps(const float *a, const float *b)
+{
+    return a[0] < b[2] && b[0] < a[2] && a[1] < b[3] && b[1] < a[3];
+}
+
+// Like command_bounds, but for a single primitive, and with transforms applied.
+static void primitive_bounds(const DrawList *list, const DrawState *state, const Vertex *v, int count, float *b)
+{
+    const DrawTransform *transform = list->transforms + state->transform;
+    float radians = transform->angle * 3.14159265f / 180;
+    float c = cosf(radians);
+    float s = sinf(radians);
+    float m[4];
+    float pad = (state->primitive == EPrimQuads) ? 0.0f : 1.0f;
+    int i;
+
+    m[0] = c * transform->scale[0];
+    m[1] = s * transform->scale[1];
+    m[2] = s * transform->scale[0];
+    m[3] = c * transform->scale[1];
+    b[0] = b[1] = b[2] = b[3] = 0;
+    for (i = 0; i < count; i++)
+    {
+        float x = v[i].x;
+        float y = v[i].y;
+        if (state->transform)
+        {
+            float dx = x - transform->x;
+            float dy = y - transform->y;
+            x = transform->x + transform->offset[0] + m[0] * dx - m[1] * dy;
+            y = transform->y + transform->offset[1] + m[2] * dx + m[3] * dy;
+        }
+        b[0] = i ? min(b[0], x) : x;
+        b[1] = i ? min(b[1], y) : y;
+        b[2] = i ? max(b[2], x) : x;
+        b[3] = i ? max(b[3], y) : y;
+    }
+
+    b[0] -= pad;
+    b[1] -= pad;
+    b[2] += pad;
+    b[3] += pad;
+}
+
+// Runs of changed cells on each row become rectangles, and a run with the same span as a
+// rectangle ending on the row below extends it instead.  Too many rectangles and the
+// whole view is repainted.
+static void merge_damage(DrawDamage *damage)
+{
+    int x, y, i, start;
+
+    damage->rect_count = 0;
+    for (y = 0; y < damage->rows; y++)
+    {
+        const unsigned int *cells = damage->cells + y * damage->cols;
+        const unsigned int *previous = damage->previous + y * damage->cols;
+        int bottom = y * DRAW_DAMAGE_CELL;
+        int top = min(damage->height, bottom + DRAW_DAMAGE_CELL);
+
+        for (x = 0; x < damage->cols; x++)
+        {
+            int left, right;
+            DrawRect *rect;
+
+            if (cells[x] == previous[x])
+                continue;
+            for (start = x; x < damage->cols && cells[x] != previous[x]; x++)
+                ;
+            left = start * DRAW_DAMAGE_CELL;
+            right = min(damage->width, x * DRAW_DAMAGE_CELL);
+
+            for (i = 0, rect = damage->rects; i < damage->rect_count; i++, rect++)
+            {
+                if (rect->x0 == left && rect->x1 == right && rect->y1 == bottom)
+                    break;
+            }
+            if (i == damage->rect_count)
+            {
+                if (damage->rect_count == DRAW_DAMAGE_CAPACITY)
+                {
+                    damage->full = 1;
+                    return;
+                }
+                damage->rect_count++;
+                rect->x0 = left;
+                rect->x1 = right;
+                rect->y0 = bottom;
+            }
+            rect->y1 = top;
+        }
+    }
+}
+
+static unsigned int hash(unsigned int seed, const void *data, int size)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+    int i;
+    for (i = 0; i < size; i++)
+        seed = (seed ^ bytes[i]) * 16777619u;
+    return seed;
+}
+
+static void *grow(void *data, int *capacity, int needed, int size)
+{
+    if (needed <= *capacity)
+        return data;
+    *capacity = max(256, max(needed, 2 * *capacity));
+    return realloc(data, *capacity * size);
+}
+
+static DrawCommand *add_command(DrawList *list, const DrawState *state)
+{
+    DrawCommand *command;
+
+    list->commands = (DrawCommand *) grow(list->commands, &list->command_capacity, list->command_count + 1, sizeof(DrawCommand));
+    command = list->commands + list->command_count++;
+    command->state = *state;
+    command->source = 0;
+    command->buffer = 0;
+    command->next = -1;
+    return command;
+}
@@ -0,0 +1,141 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+
+// A frame's worth of draw commands, recorded by the draw_* functions and submitted in
+// one go by the backend.  Nothing in here knows about GL; textures and buffers are
+// opaque handles that only the backend interprets.
+
+typedef struct
+{
+    float x, y;
+    float s, t;
+    float r, g, b, a;
+} Vertex;
+
+typedef enum
+{
+    EPrimQuads,
+    EPrimLines,
+    EPrimPoints,
+    EPrimCapture,   // copy everything drawn so far into the state's texture
+} Primitive;
+
+typedef struct
+{
+    Primitive primitive;
+    unsigned int texture;       // 0 for untextured geometry
+    unsigned char scissor;      // clip to the board
+    unsigned char blend;        // alpha blending
+    unsigned char transform;    // index into the list's transforms, 0 for none
+    unsigned char color;        // index into the list's colors, 0 for the vertices' own
+    unsigned char pass;         // GPU profiling phase of the draw pass, 0 outside PROFILE builds
+} DrawState;
+
+// Scale and rotate about a pivot, then move by an offset.  Animations keep their
+// geometry resident and vary only this, and the color, from frame to frame.
+typedef struct
+{
+    float x, y;
+    float angle;
+    float scale[2];
+    float offset[2];
+} DrawTransform;
+
+// Geometry is either in the list's own vertex stream (source is 0), or in a
+// cached array that the backend may also hold in a buffer object.
+typedef struct
+{
+    DrawState state;
+    const Vertex *source;
+    unsigned int buffer;
+    int first;
+    int count;
+    float bounds[4];
+    int next;
+} DrawCommand;
+
+// Commands with the same state merged together; stream geometry is gathered
+// into one contiguous range of the list's sorted vertices.
+typedef struct
+{
+    DrawState state;
+    const Vertex *source;
+    unsigned int buffer;
+    int first;
+    int count;
+} DrawBatch;
+
+#define DRAW_TRANSFORM_CAPACITY 16
+#define DRAW_COLOR_CAPACITY 8
+#define DRAW_DAMAGE_CELL 16
+#define DRAW_DAMAGE_CAPACITY 16
+
+// A region of the view to repaint, in view units.
+typedef struct
+{
+    int x0, y0, x1, y1;
+} DrawRect;
+
+// Dirty-rectangle tracking.  Every primitive is hashed, in order, into the grid cells
+// its bounds touch; cells whose hash differs from the previous frame's are merged into
+// rectangles, and only those need repainting.
+typedef struct
+{
+    int width, height;
+    int cols, rows;
+    unsigned int *cells;
+    unsigned int *previous;
+    int valid;
+    int full;
+    DrawRect rects[DRAW_DAMAGE_CAPACITY];
+    int rect_count;
+} DrawDamage;
+
+typedef struct
+{
+    Vertex *vertices;
+    int vertex_count;
+    int vertex_capacity;
+
+    DrawCommand *commands;
+    int command_count;
+    int command_capacity;
+
+    DrawTransform transforms[DRAW_TRANSFORM_CAPACITY];
+    int transform_count;
+
+    // Solid colors that replace those of the vertices.
+    float colors[DRAW_COLOR_CAPACITY][4];
+    int color_count;
+
+    // Clear the frame before drawing anything.
+    int clear;
+
+    // Set by drawlist_damage; when present, only its rectangles need repainting and
+    // everything else is left as the previous frame drew it.
+    const DrawDamage *damage;
+
+    // Filled by drawlist_sort.
+    Vertex *sorted;
+    int sorted_capacity;
+    DrawBatch *batches;
+    int batch_count;
+    int batch_capacity;
+} DrawList;
+
+void    drawlist_create(DrawList *);
+void    drawlist_destroy(DrawList *);
+void    drawlist_reset(DrawList *);
+void    drawlist_clear(DrawList *);
+void    drawlist_capture(DrawList *, unsigned int texture);
+Vertex *drawlist_append(DrawList *, const DrawState *, int count);
+void    drawlist_cached(DrawList *, const DrawState *, const Vertex *source, unsigned int buffer, int first, int count);
+int     drawlist_transform(DrawList *, const DrawTransform *);
+int     drawlist_color(DrawList *, float r, float g, float b, float a);
+void    drawlist_sort(DrawList *);
+void    drawlist_damage(DrawList *, DrawDamage *);
+
+void    drawlist_damage_create(DrawDamage *, int width, int height);
+void    drawlist_damage_destroy(DrawDamage *);
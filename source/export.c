@@ -0,0 +1,360 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// Renders a session recorded with 'tetrita -record' to video, without a display.  The
+// game runs on the software rasterizer, whose osPresent calls land here instead of in
+// an OS layer.  Capture, encoding and output overlap: the main thread simulates and
+// renders, a pool of workers converts frames, and a writer thread emits them in order.
+//
+// Usage: tetrita-export [-ppm] [-dirty] [-threads N] [-o output] session.replay
+//
+// The default output is a YUV4MPEG2 stream at the game's 60 Hz, which ffmpeg and most
+// players read directly; -ppm writes concatenated binary PPMs instead.  Output goes to
+// stdout unless -o is given.  -dirty renders only what changed between frames, which
+// doesn't change the output.
+
+#include <pthread.h>
+#include <unistd.h>
+#include "os.h"
+#include "game.h"
+#include "draw.h"
+#include "replay.h"
+#include "trace.h"
+
+#define SLOTS_PER_WORKER 2
+
+typedef enum
+{
+    EFormatY4m,
+    EFormatPpm,
+} Format;
+
+typedef enum
+{
+    ESlotFree,
+    ESlotCaptured,
+    ESlotEncoding,
+    ESlotEncoded,
+} SlotState;
+
+typedef struct
+{
+    SlotState state;
+    unsigned char *rgba;
+    unsigned char *encoded;
+    int size;
+} Slot;
+
+// Frame n always travels through slot n % slot_count, so the writer only has to wait
+// for the next slot in turn to keep the output in order.
+static struct
+{
+    Format format;
+    FILE *output;
+    Slot *slots;
+    int slot_count;
+    unsigned int captured;
+    unsigned int encoding;
+    unsigned int written;
+    int finished;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} pipeline;
+
+static void *encode_thread(void *);
+static void *write_thread(void *);
+static int encode_y4m(unsigned char *dest, const unsigned char *rgba);
+static int encode_ppm(unsigned char *dest, const unsigned char *rgba);
+static void usage();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    const char *filename = 0;
+    const char *output = 0;
+    int workers = (int) sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    unsigned long long start, elapsed;
+    pthread_t *threads;
+    pthread_t writer;
+    Replay *replay;
+    Game *game;
+    unsigned int frame;
+    int i, event;
+
+    pipeline.format = EFormatY4m;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-ppm"))
+            pipeline.format = EFormatPpm;
+        else if (!strcmp(argv[i], "-dirty"))
+            draw_partial(1);
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (argv[i][0] == '-' || filename)
+            usage();
+        else
+            filename = argv[i];
+    }
+    if (!filename)
+        usage();
+    workers = max(1, workers);
+
+    replay = replay_load(filename);
+    if (!replay)
+        fatalf("Error: couldn't read %s\n", filename);
+
+    pipeline.output = (output && strcmp(output, "-")) ? fopen(output, "wb") : stdout;
+    if (!pipeline.output)
+        fatalf("Error: couldn't write %s\n", output);
+    if (pipeline.format == EFormatY4m)
+        fprintf(pipeline.output, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", VIEW_WIDTH, VIEW_HEIGHT, (int) MAX_FPS);
+
+    pipeline.slot_count = SLOTS_PER_WORKER * workers + 2;
+    pipeline.slots = (Slot *) calloc(pipeline.slot_count, sizeof(Slot));
+    for (i = 0; i < pipeline.slot_count; i++)
+    {
+        pipeline.slots[i].rgba = (unsigned char *) malloc(4 * VIEW_WIDTH * VIEW_HEIGHT);
+        pipeline.slots[i].encoded = (unsigned char *) malloc(3 * VIEW_WIDTH * VIEW_HEIGHT + 64);
+    }
+    pthread_mutex_init(&pipeline.lock, 0);
+    pthread_cond_init(&pipeline.changed, 0);
+
+    threads = (pthread_t *) malloc(workers * sizeof(pthread_t));
+    for (i = 0; i < workers; i++)
+        pthread_create(threads + i, 0, encode_thread, 0);
+    pthread_create(&writer, 0, write_thread, 0);
+
+    // Mirror main(): buttons stamped with a frame are applied before that frame's
+    // update, and the game doesn't update while paused.
+    TRACE_THREAD("main");
+    start = osGetMicroseconds();
+    srand(replay->seed);
+    game = game_create();
+    for (frame = 0, event = 0; frame < replay->frames; frame++)
+    {
+        GameState state;
+
+        for (; event < replay->count && replay->events[event].frame == frame; event++)
+        {
+            if (replay->events[event].pressed)
+                game_press(game, replay->events[event].button);
+            else
+                game_release(game, replay->events[event].button);
+        }
+
+        state = game_state(game);
+        if (state == EPaused || state == EDone)
+            break;
+
+        TRACE_BEGIN("update");
+        game_update(game);
+        TRACE_END("update");
+        TRACE_BEGIN("draw");
+        game_draw(game);
+        TRACE_END("draw");
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.finished = 1;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+    for (i = 0; i < workers; i++)
+        pthread_join(threads[i], 0);
+    pthread_join(writer, 0);
+    elapsed = osGetMicroseconds() - start;
+
+    fprintf(stderr, "%u frames in %.2f s, %.0f fps, %.1fx real time\n",
+        pipeline.written,
+        elapsed / 1e6,
+        pipeline.written * 1e6 / max(elapsed, 1ull),
+        pipeline.written / MAX_FPS * 1e6 / max(elapsed, 1ull));
+
+    TRACE_DUMP("tetrita-export.trace.json");
+    game_destroy(game);
+    replay_close(replay, 0);
+    if (pipeline.output != stdout)
+        fclose(pipeline.output);
+    for (i = 0; i < pipeline.slot_count; i++)
+    {
+        free(pipeline.slots[i].rgba);
+        free(pipeline.slots[i].encoded);
+    }
+    free(pipeline.slots);
+    free(threads);
+    return 0;
+}
+
+// The software rasterizer's finished frame; copied into the next slot once the writer
+// has released it.
+void osPresent(const unsigned char *rgba, int width, int height)
+{
+    Slot *slot = pipeline.slots + pipeline.captured % pipeline.slot_count;
+
+    assert(width == VIEW_WIDTH && height == VIEW_HEIGHT);
+    pthread_mutex_lock(&pipeline.lock);
+    while (slot->state != ESlotFree)
+        pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+    pthread_mutex_unlock(&pipeline.lock);
+
+    memcpy(slot->rgba, rgba, 4 * width * height);
+
+    pthread_mutex_lock(&pipeline.lock);
+    slot->state = ESlotCaptured;
+    pipeline.captured++;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+}
+
+// Only the profiler and tracer ask for the time.
+unsigned int osGetMilliseconds()
+{
+    return (unsigned int) (osGetMicroseconds() / 1000);
+}
+
+unsigned long long osGetMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void *encode_thread(void *)
+{
+    TRACE_THREAD("encode");
+    pthread_mutex_lock(&pipeline.lock);
+    while (1)
+    {
+        Slot *slot = pipeline.slots + pipeline.encoding % pipeline.slot_count;
+
+        if (pipeline.encoding < pipeline.captured)
+        {
+            slot->state = ESlotEncoding;
+            pipeline.encoding++;
+            pthread_mutex_unlock(&pipeline.lock);
+
+            TRACE_BEGIN("encode");
+            if (pipeline.format == EFormatY4m)
+                slot->size = encode_y4m(slot->encoded, slot->rgba);
+            else
+                slot->size = encode_ppm(slot->encoded, slot->rgba);
+            TRACE_END("encode");
+
+            pthread_mutex_lock(&pipeline.lock);
+            slot->state = ESlotEncoded;
+            pthread_cond_broadcast(&pipeline.changed);
+        }
+        else if (pipeline.finished)
+        {
+            break;
+        }
+        else
+        {
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        }
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+    return 0;
+}
+
+static void *write_thread(void *)
+{
+    TRACE_THREAD("write");
+    pthread_mutex_lock(&pipeline.lock);
+    while (1)
+    {
+        Slot *slot = pipeline.slots + pipeline.written % pipeline.slot_count;
+
+        if (pipeline.written < pipeline.captured && slot->state == ESlotEncoded)
+        {
+            pthread_mutex_unlock(&pipeline.lock);
+
+            TRACE_BEGIN("write");
+            if (fwrite(slot->encoded, 1, slot->size, pipeline.output) != (size_t) slot->size)
+                fatalf("Error: couldn't write frame %u\n", pipeline.written);
+            TRACE_END("write");
+
+            pthread_mutex_lock(&pipeline.lock);
+            slot->state = ESlotFree;
+            pipeline.written++;
+            pthread_cond_broadcast(&pipeline.changed);
+        }
+        else if (pipeline.finished && pipeline.written == pipeline.captured)
+        {
+            break;
+        }
+        else
+        {
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        }
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+    fflush(pipeline.output);
+    return 0;
+}
+
+// Full-range BT.601 with 2x2 chroma averaging, flipping the bottom-up framebuffer.
+static int encode_y4m(unsigned char *dest, const unsigned char *rgba)
+{
+    const int w = VIEW_WIDTH;
+    const int h = VIEW_HEIGHT;
+    unsigned char *luma = dest + 6;
+    unsigned char *cb = luma + w * h;
+    unsigned char *cr = cb + (w / 2) * (h / 2);
+    int x, y;
+
+    memcpy(dest, "FRAME\n", 6);
+    for (y = 0; y < h; y++)
+    {
+        const unsigned char *src = rgba + 4 * (h - 1 - y) * w;
+        for (x = 0; x < w; x++, src += 4)
+            *luma++ = (unsigned char) ((77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8);
+    }
+
+    for (y = 0; y < h; y += 2)
+    {
+        const unsigned char *upper = rgba + 4 * (h - 1 - y) * w;
+        const unsigned char *lower = upper - 4 * w;
+        for (x = 0; x < w; x += 2, upper += 8, lower += 8)
+        {
+            int r = upper[0] + upper[4] + lower[0] + lower[4];
+            int g = upper[1] + upper[5] + lower[1] + lower[5];
+            int b = upper[2] + upper[6] + lower[2] + lower[6];
+            *cb++ = (unsigned char) min(255, ((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128);
+            *cr++ = (unsigned char) min(255, ((128 * r - 107 * g - 21 * b + 512) >> 10) + 128);
+        }
+    }
+
+    return (int) (cr - dest);
+}
+
+static int encode_ppm(unsigned char *dest, const unsigned char *rgba)
+{
+    const int w = VIEW_WIDTH;
+    const int h = VIEW_HEIGHT;
+    int header = sprintf((char *) dest, "P6\n%d %d\n255\n", w, h);
+    unsigned char *rgb = dest + header;
+    int x, y;
+
+    for (y = 0; y < h; y++)
+    {
+        const unsigned char *src = rgba + 4 * (h - 1 - y) * w;
+        for (x = 0; x < w; x++, src += 4, rgb += 3)
+        {
+            rgb[0] = src[0];
+            rgb[1] = src[1];
+            rgb[2] = src[2];
+        }
+    }
+
+    return (int) (rgb - dest);
+}
+
+static void usage()
+{
+    fatalf("Usage: tetrita-export [-ppm] [-dirty] [-threads N] [-o output] session.replay\n");
+}
@@ -0,0 +1,98 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "font.h"
+
+#define KERNING_KEY(first, second) ((unsigned int) (first) << 16 | (second))
+#define KERNING_HASH(key, bits) (((key) * 2654435761u) >> (32 - (bits)))
+
+void font_create(FontInfo *info)
+{
+    const Glyph *glyph;
+    const Kerning *k;
+    int count = 0, mask;
+
+    memset(info->glyph_index, 0, sizeof(info->glyph_index));
+    for (glyph = info->glyphs; glyph->id; glyph++)
+    {
+        if (glyph->id < GLYPH_INDEX_SIZE && !info->glyph_index[glyph->id])
+            info->glyph_index[glyph->id] = glyph;
+    }
+
+    // Open addressing with linear probing, kept at most half full.
+    for (k = info->pairs; k && k->first; k++)
+        count++;
+    info->kerning = 0;
+    info->kerning_bits = 0;
+    if (count)
+    {
+        info->kerning_bits = 1;
+        while ((1 << info->kerning_bits) < 2 * count)
+            info->kerning_bits++;
+        mask = (1 << info->kerning_bits) - 1;
+        info->kerning = (KerningSlot *) calloc(mask + 1, sizeof(KerningSlot));
+        for (k = info->pairs + count - 1; k >= info->pairs; k--)
+        {
+            unsigned int key = KERNING_KEY(k->first, k->second);
+            unsigned int slot = KERNING_HASH(key, info->kerning_bits);
+            while (info->kerning[slot].key && info->kerning[slot].key != key)
+                slot = (slot + 1) & mask;
+            info->kerning[slot].key = key;
+            info->kerning[slot].amount = k->amount;
+        }
+    }
+
+    info->indexed = 1;
+}
+
+void font_destroy(FontInfo *info)
+{
+    free(info->kerning);
+    info->kerning = 0;
+    info->indexed = 0;
+}
+
+const Glyph *font_glyph(const FontInfo *info, int id)
+{
+    const Glyph *glyph;
+
+    if (info->indexed && id >= 0 && id < GLYPH_INDEX_SIZE)
+        return info->glyph_index[id];
+
+    for (glyph = info->glyphs; glyph->id; glyph++)
+    {
+        if (glyph->id == id)
+            return glyph;
+    }
+    return 0;
+}
+
+int font_kerning(const FontInfo *info, unsigned short first, unsigned short second)
+{
+    const Kerning *k;
+
+    if (info->indexed)
+    {
+        unsigned int key = KERNING_KEY(first, second);
+        unsigned int mask = (1 << info->kerning_bits) - 1;
+        unsigned int slot;
+
+        if (!info->kerning)
+            return 0;
+
+        for (slot = KERNING_HASH(key, info->kerning_bits); info->kerning[slot].key; slot = (slot + 1) & mask)
+        {
+            if (info->kerning[slot].key == key)
+                return info->kerning[slot].amount;
+        }
+        return 0;
+    }
+
+    for (k = info->pairs; k && k->first; k++)
+    {
+        if (k->first == first && k->second == second)
+            return k->amount;
+    }
+    return 0;
+}
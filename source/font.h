@@ -22,6 +22,14 @@ typedef struct
     short amount;
 } Kerning;
 
+#define GLYPH_INDEX_SIZE 256
+
+typedef struct
+{
+    unsigned int key;
+    short amount;
+} KerningSlot;
+
 typedef struct
 {
     const char **image;
@@ -32,4 +40,15 @@ typedef struct
     int base;
     int line_height;
     unsigned int texture;
+
+    // Lookup tables built by font_create; until then the lookups scan the arrays above.
+    int indexed;
+    const Glyph *glyph_index[GLYPH_INDEX_SIZE];
+    KerningSlot *kerning;
+    int kerning_bits;
 } FontInfo;
+
+void         font_create(FontInfo *);
+void         font_destroy(FontInfo *);
+const Glyph *font_glyph(const FontInfo *, int id);
+int          font_kerning(const FontInfo *, unsigned short first, unsigned short second);
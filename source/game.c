@@ -4,6 +4,8 @@
 #include "os.h"
 #include "game.h"
 #include "draw.h"
+#include "profile.h"
+#include "trace.h"
 
 struct GameRec
 {
@@ -14,6 +16,7 @@ struct GameRec
     GameState state;
     GameState saved_state;
     TileRow board[ROW_COUNT];
+    unsigned int board_generation;
     int completion[4];
     int holdthru;
     int score;
@@ -44,6 +47,7 @@ Game *game_create()
     game->saved_state = game->state = START_STATE;
     game->moving = 0;
     game->accelerating = 0;
+    game->board_generation = 0;
     game_reset(game);
     return game;
 }
@@ -69,11 +73,11 @@ void game_draw(const Game *game)
         draw_begin_tiles(game->graphics);
         if (state == ELocking)
             draw_lock(&game->current_piece, (float) game->frame / DURATION);
-        draw_board(game->board);
+        draw_board(game->board, game->board_generation);
         if (state != EEndQuery)
             draw_piece(&game->current_piece);
         if (state == ECompleting)
-            draw_completions(game->board, game->completion, game->frame);
+            draw_completions(game->completion, game->frame);
         draw_end_tiles();
 
         if (state & (EPlay | ESlamming | ESettle | ELocking | ECompleting))
@@ -113,6 +117,25 @@ void game_draw(const Game *game)
         sprintf(score_text, "score: %d\nlevel: %d", game->score, game->level);
         draw_text(game->graphics, ENumerals, score_text, 32, 215, game->level);
     }
+
+#ifdef PROFILE
+    // The report is refreshed a few times a second, so that between refreshes the overlay
+    // comes from the layout cache and costs EPhaseText no more than the score does.
+    if (profile_visible())
+    {
+        static char report[1024];
+        static unsigned long long refreshed;
+        unsigned long long now = osGetMicroseconds();
+        if (!report[0] || now - refreshed >= 250000)
+        {
+            profile_report(report, sizeof(report));
+            refreshed = now;
+        }
+        draw_text(game->graphics, EVera, report, 80, 140, game->level);
+    }
+#endif
+
+    draw_flush();
 }
 
 void game_reset(Game *game)
@@ -126,6 +149,7 @@ void game_reset(Game *game)
     game->score = 0;
     game->level = 0;
     memset(game->board, 0, sizeof(game->board));
+    game->board_generation++;
 }
 
 void game_update(Game *game)
@@ -184,8 +208,15 @@ void game_update(Game *game)
         {
             int completions;
             lock_piece(&game->current_piece, game->board);
+            game->board_generation++;
             completions = check_completions(game);
             game->score += game->points;
+            if (game->score / 100 != game->level)
+            {
+                TRACE_INSTANT("level change");
+                if (BASIL_INDEX(game->score / 100) != BASIL_INDEX(game->level))
+                    TRACE_INSTANT("backdrop swap");
+            }
             game->level = game->score / 100;
             game->speed = 0.01f * (game->level + 3);
             if (completions)
@@ -228,6 +259,7 @@ void game_press(Game *game, Button button)
         case ESlam:
             if (game->state == EPlay)
             {
+                TRACE_INSTANT("ESlamming");
                 game->state = ESlamming;
                 game->frame = 0;
             }
@@ -422,6 +454,7 @@ static int check_completions(Game *game)
     }
     if (count)
     {
+        TRACE_INSTANT("ECompleting");
         game->frame = 0;
         game->state = ECompleting;
         switch (count)
@@ -496,6 +529,7 @@ static void nuke_lines(Game *game)
                 process_upward_tiles(game->board, completion + 1);
         }
     }
+    game->board_generation++;
 }
 
 static void pop_piece(Game *game)
@@ -3,6 +3,20 @@
 
 #include "os.h"
 #include "image.h"
+#include "trace.h"
+
+// The asset decoders have vector paths for x86, picked at runtime from what the CPU
+// supports, and for NEON, which every target that defines __ARM_NEON has.  Build with
+// 'make NO_SIMD=1' to compare them with the scalar code.
+#ifndef NO_SIMD
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
 
 float clamp(float val)
 {
@@ -86,270 +100,449 @@ int encode(unsigned char *data, int size, FILE *fp)
     return rows;
 }
 
+// Every four characters of an asset string carry three bytes, six bits apiece, and a
+// group may straddle two strings.
+typedef struct
+{
+    unsigned char *dest;
+    unsigned char prev;
+    int shift;
+} Unpacker;
+
+// Unpacks whole groups from the start of src, returning how many characters it used.
+typedef int (*Unpack)(unsigned char *dest, const char *src, int length);
+
+// The state is kept in locals, since stores through dest could alias it.
+static void unpack_chars(Unpacker *u, const char *bytes, const char *end)
+{
+    unsigned char *dest = u->dest;
+    unsigned char prev = u->prev;
+    int shift = u->shift;
+
+    for (; bytes < end; bytes++)
+    {
+        unsigned char i6 = *bytes - '0';
+
+        if (shift == 1)
+            *dest++ = (prev << 2) | (i6 >> 4);
+        else if (shift == 2)
+            *dest++ = (prev << 4) | (i6 >> 2);
+        else if (shift == 3)
+            *dest++ = (prev << 6) | i6;
+
+        shift = (shift + 1) % 4;
+        prev = i6;
+    }
+
+    u->dest = dest;
+    u->prev = prev;
+    u->shift = shift;
+}
+
+static int unpack_scalar(unsigned char *dest, const char *src, int length)
+{
+    int used;
+
+    for (used = 0; used + 4 <= length; used += 4, dest += 3)
+    {
+        unsigned char c0 = src[used + 0] - '0';
+        unsigned char c1 = src[used + 1] - '0';
+        unsigned char c2 = src[used + 2] - '0';
+        unsigned char c3 = src[used + 3] - '0';
+
+        dest[0] = (c0 << 2) | (c1 >> 4);
+        dest[1] = (c1 << 4) | (c2 >> 2);
+        dest[2] = (c2 << 6) | c3;
+    }
+    return used;
+}
+
+#ifdef SIMD_X86
+
+// Each group becomes c0 << 18 | c1 << 12 | c2 << 6 | c3 in its 32-bit lane, through one
+// multiply-add of neighboring bytes and one of neighboring words, and the shuffle takes
+// its three bytes out high byte first.  The multiplies are only exact for six-bit
+// values, so the scalar code takes over from any block holding another character.
+__attribute__((target("ssse3")))
+static int unpack_ssse3(unsigned char *dest, const char *src, int length)
+{
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i top = _mm_set1_epi8(63);
+    const __m128i pairs = _mm_set1_epi32(0x01400140);
+    const __m128i quads = _mm_set1_epi32(0x00011000);
+    const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int used = 0;
+
+    for (; used + 16 <= length; used += 16, dest += 12)
+    {
+        __m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (src + used)), zero);
+        int high;
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, top), top)) != 0xffff)
+            break;
+        v = _mm_shuffle_epi8(_mm_madd_epi16(_mm_maddubs_epi16(v, pairs), quads), order);
+        _mm_storel_epi64((__m128i *) dest, v);
+        high = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        memcpy(dest + 8, &high, 4);
+    }
+    return used + unpack_scalar(dest, src + used, length - used);
+}
+
+// As above, with the two lanes' 12 bytes gathered into the low 24 before storing.
+__attribute__((target("avx2")))
+static int unpack_avx2(unsigned char *dest, const char *src, int length)
+{
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i top = _mm256_set1_epi8(63);
+    const __m256i pairs = _mm256_set1_epi32(0x01400140);
+    const __m256i quads = _mm256_set1_epi32(0x00011000);
+    const __m256i order = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int used = 0;
+
+    for (; used + 32 <= length; used += 32, dest += 24)
+    {
+        __m256i v = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *) (src + used)), zero);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, top), top)) != -1)
+            break;
+        v = _mm256_shuffle_epi8(_mm256_madd_epi16(_mm256_maddubs_epi16(v, pairs), quads), order);
+        v = _mm256_permutevar8x32_epi32(v, gather);
+        _mm_storeu_si128((__m128i *) dest, _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *) (dest + 16), _mm256_extracti128_si256(v, 1));
+    }
+    return used + unpack_ssse3(dest, src + used, length - used);
+}
+
+#endif
+
+#ifdef SIMD_NEON
+
+// The interleaved load splits 64 characters into each group's first, second, third
+// and fourth, so the bytes come out of the same shifts as in the scalar code.
+static int unpack_neon(unsigned char *dest, const char *src, int length)
+{
+    const uint8x16_t zero = vdupq_n_u8('0');
+    int used = 0;
+
+    for (; used + 64 <= length; used += 64, dest += 48)
+    {
+        uint8x16x4_t c = vld4q_u8((const uint8_t *) src + used);
+        uint8x16x3_t b;
+        uint8x16_t c0 = vsubq_u8(c.val[0], zero);
+        uint8x16_t c1 = vsubq_u8(c.val[1], zero);
+        uint8x16_t c2 = vsubq_u8(c.val[2], zero);
+        uint8x16_t c3 = vsubq_u8(c.val[3], zero);
+
+        b.val[0] = vorrq_u8(vshlq_n_u8(c0, 2), vshrq_n_u8(c1, 4));
+        b.val[1] = vorrq_u8(vshlq_n_u8(c1, 4), vshrq_n_u8(c2, 2));
+        b.val[2] = vorrq_u8(vshlq_n_u8(c2, 6), c3);
+        vst3q_u8(dest, b);
+    }
+    return used + unpack_scalar(dest, src + used, length - used);
+}
+
+#endif
+
+static Unpack pick_unpack()
+{
+#if defined(SIMD_X86)
+    if (__builtin_cpu_supports("avx2"))
+        return unpack_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return unpack_ssse3;
+#elif defined(SIMD_NEON)
+    return unpack_neon;
+#endif
+    return unpack_scalar;
+}
+
 int decode(unsigned char *dest, const char **src)
 {
-    unsigned char prev = 0;
-    int shift = 0;
-    int written = 0;
+    Unpack unpack = pick_unpack();
+    Unpacker u;
     const char *bytes;
 
+    TRACE_BEGIN("decode");
+    u.dest = dest;
+    u.prev = 0;
+    u.shift = 0;
     while ((bytes = *src++) && *bytes)
     {
-        while (bytes && *bytes)
+        const char *end = bytes + strlen(bytes);
+        const char *aligned = bytes + min((4 - u.shift) % 4, (int) (end - bytes));
+
+        // Finish the group the previous string left open, then take whole groups as
+        // fast as the CPU allows, and leave the last few characters to the state machine.
+        unpack_chars(&u, bytes, aligned);
+        bytes = aligned;
+        if (u.shift == 0)
         {
-            unsigned char i6 = *bytes - '0';
-
-            if (shift == 1)
-                *dest++ = (prev << 2) | (i6 >> 4);
-            else if (shift == 2)
-                *dest++ = (prev << 4) | (i6 >> 2);
-            else if (shift == 3)
-                *dest++ = (prev << 6) | i6;
-
-            if (shift)
-                written++;
-
-            shift = (shift + 1) % 4;
-            prev = i6;
-            bytes++;
+            int used = unpack(u.dest, bytes, (int) (end - bytes));
+            u.dest += used / 4 * 3;
+            bytes += used;
         }
+        unpack_chars(&u, bytes, end);
     }
 
     // note that this requires the caller to allocate an extra byte
     // in dest memory for cases where the size is not a multiple of 12
-    if (shift == 1)
-        *dest++ = (prev << 2);
-    else if (shift == 2)
-        *dest++ = (prev << 4);
-    else if (shift == 3)
-        *dest++ = (prev << 6);
+    if (u.shift == 1)
+        *u.dest++ = (u.prev << 2);
+    else if (u.shift == 2)
+        *u.dest++ = (u.prev << 4);
+    else if (u.shift == 3)
+        *u.dest++ = (u.prev << 6);
+
+    TRACE_END("decode");
+    return (int) (u.dest - dest);
+}
 
-    if (shift)
-        written++;
+// Block compression, as BC1 (DXT1) and BC3 (DXT5).  Each block's palette is built once,
+// rounding as the decoder always has: endpoints widened without replicating their top
+// bits, and thirds, halves, sevenths and fifths rounded down.  The indices then look up
+// the palette a row at a time.  Colors are packed as little-endian RGBA, with the alpha
+// zeroed, so one palette serves both formats, and alphas are packed eight to a word;
+// the vector code moves them straight into registers, as reloading a palette built a
+// byte at a time would stall on the stores.
+typedef struct
+{
+    unsigned int colors[4];
+    unsigned long long alphas;
+    unsigned int indices;
+    unsigned long long alpha_indices;
+} Block;
+
+// Expands a whole block, given the distance between its rows in dest.
+typedef void (*Expand)(unsigned char *dest, int pitch, const Block *block);
 
-    return written;
+static unsigned int pack_color(int red, int grn, int blu)
+{
+    return red | grn << 8 | blu << 16;
 }
 
-static void decode_dxt(unsigned char *dst, unsigned char code,
-                       unsigned short rgb0, unsigned short rgb1,
-                       int hasAlpha, int encoding)
+// BC3 always takes four colors, whichever endpoint is larger.
+static void color_block(Block *block, const unsigned char *p, int four)
 {
-    unsigned char red0 = (rgb0 >> 11) << 3;
-    unsigned char grn0 = ((rgb0 >> 5) & 0x3f) << 2;
-    unsigned char blu0 = (rgb0 & 0x1f) << 3;
-    unsigned char red1 = (rgb1 >> 11) << 3;
-    unsigned char grn1 = ((rgb1 >> 5) & 0x3f) << 2;
-    unsigned char blu1 = (rgb1 & 0x1f) << 3;
-    unsigned char red, grn, blu, alp;
-
-    if (encoding)
+    unsigned short rgb0 = p[0] | p[1] << 8;
+    unsigned short rgb1 = p[2] | p[3] << 8;
+    int red0 = (rgb0 >> 11) << 3;
+    int grn0 = ((rgb0 >> 5) & 0x3f) << 2;
+    int blu0 = (rgb0 & 0x1f) << 3;
+    int red1 = (rgb1 >> 11) << 3;
+    int grn1 = ((rgb1 >> 5) & 0x3f) << 2;
+    int blu1 = (rgb1 & 0x1f) << 3;
+
+    unsigned int third0 = pack_color((2 * red0 + red1) / 3, (2 * grn0 + grn1) / 3, (2 * blu0 + blu1) / 3);
+    unsigned int third1 = pack_color((2 * red1 + red0) / 3, (2 * grn1 + grn0) / 3, (2 * blu1 + blu0) / 3);
+    unsigned int half = pack_color((red0 + red1) / 2, (grn0 + grn1) / 2, (blu0 + blu1) / 2);
+
+    four = four || rgb0 > rgb1;
+    block->colors[0] = pack_color(red0, grn0, blu0);
+    block->colors[1] = pack_color(red1, grn1, blu1);
+    block->colors[2] = four ? third0 : half;
+    block->colors[3] = four ? third1 : 0;
+
+    block->indices = p[4] | p[5] << 8 | p[6] << 16 | (unsigned int) p[7] << 24;
+}
+
+static void alpha_block(Block *block, const unsigned char *p)
+{
+    unsigned long long alphas = p[0] | p[1] << 8;
+    int alp0 = p[0], alp1 = p[1];
+    int i;
+
+    if (alp0 > alp1)
     {
-        switch (code)
-        {
-            case 0:
-                red = red0;
-                grn = grn0;
-                blu = blu0;
-                alp = 0xff;
-                break;
-
-            case 1:
-                red = red1;
-                grn = grn1;
-                blu = blu1;
-                alp = 0xff;
-                break;
-
-            case 2:
-                red = (2 * red0 + red1) / 3;
-                grn = (2 * grn0 + grn1) / 3;
-                blu = (2 * blu0 + blu1) / 3;
-                alp = 0xff;
-                break;
-
-            case 3:
-                red = (2 * red1 + red0) / 3;
-                grn = (2 * grn1 + grn0) / 3;
-                blu = (2 * blu1 + blu0) / 3;
-                alp = 0xff;
-                break;
-        }
+        for (i = 1; i < 7; i++)
+            alphas |= (unsigned long long) (((7 - i) * alp0 + i * alp1) / 7) << (8 * (i + 1));
     }
     else
     {
-        switch (code)
-        {
-            case 0:
-                red = red0;
-                grn = grn0;
-                blu = blu0;
-                alp = 0xff;
-                break;
-
-            case 1:
-                red = red1;
-                grn = grn1;
-                blu = blu1;
-                alp = 0xff;
-                break;
-
-            case 2:
-                red = (red0 + red1) / 2;
-                grn = (grn0 + grn1) / 2;
-                blu = (blu0 + blu1) / 2;
-                alp = 0xff;
-                break;
-
-            case 3:
-                red = 0;
-                grn = 0;
-                blu = 0;
-                alp = 0;
-                break;
-        }
+        for (i = 1; i < 5; i++)
+            alphas |= (unsigned long long) (((5 - i) * alp0 + i * alp1) / 5) << (8 * (i + 1));
+        alphas |= 255ull << 56;
     }
+    block->alphas = alphas;
 
-    *(dst++) = red;
-    *(dst++) = grn;
-    *(dst++) = blu;
-    if (hasAlpha)
-        *(dst++) = alp;
+    block->alpha_indices = 0;
+    for (i = 7; i >= 2; i--)
+        block->alpha_indices = block->alpha_indices << 8 | p[i];
 }
 
-static unsigned char decode_latc(unsigned char code, unsigned char lum0, unsigned char lum1, unsigned char minlum, unsigned char maxlum)
+static void expand_rgb(unsigned char *dest, int pitch, const Block *block)
 {
-    if (lum0 > lum1)
+    unsigned int indices = block->indices;
+    int x, y;
+
+    for (y = 0; y < 4; y++, dest += pitch)
     {
-        switch (code)
-        {
-            case 0: return lum0;
-            case 1: return lum1;
-            case 2: return (6*lum0+  lum1)/7;
-            case 3: return (5*lum0+2*lum1)/7;
-            case 4: return (4*lum0+3*lum1)/7;
-            case 5: return (3*lum0+4*lum1)/7;
-            case 6: return (2*lum0+5*lum1)/7;
-            case 7: return (  lum0+6*lum1)/7;
-        }
+        for (x = 0; x < 4; x++, indices >>= 2)
+            memcpy(dest + x * 3, &block->colors[indices & 3], 3);
     }
-    else
+}
+
+static void expand_rgba(unsigned char *dest, int pitch, const Block *block)
+{
+    unsigned int indices = block->indices;
+    unsigned long long alpha_indices = block->alpha_indices;
+    int x, y;
+
+    for (y = 0; y < 4; y++, dest += pitch)
     {
-        switch (code)
+        for (x = 0; x < 4; x++, indices >>= 2, alpha_indices >>= 3)
         {
-            case 0: return lum0;
-            case 1: return lum1;
-            case 2: return (4*lum0+  lum1)/5;
-            case 3: return (3*lum0+2*lum1)/5;
-            case 4: return (2*lum0+3*lum1)/5;
-            case 5: return (  lum0+4*lum1)/5;
-            case 6: return minlum;
-            case 7: return maxlum;
+            unsigned int rgba = block->colors[indices & 3] | (unsigned int) (block->alphas >> (8 * (alpha_indices & 7))) << 24;
+            memcpy(dest + x * 4, &rgba, 4);
         }
     }
-    return 0;
+}
+
+#ifdef SIMD_X86
+
+// Shuffles that take a row's four pixels out of the colors, indexed by the row's eight
+// bits of color codes.
+#define SHUFFLE_RGB(c) 4 * (c), 4 * (c) + 1, 4 * (c) + 2
+#define SHUFFLE_RGBA(c) SHUFFLE_RGB(c), 4 * (c) + 3
+#define ROW_RGB(i) { SHUFFLE_RGB((i) & 3), SHUFFLE_RGB((i) >> 2 & 3), SHUFFLE_RGB((i) >> 4 & 3), SHUFFLE_RGB((i) >> 6 & 3), 0x80, 0x80, 0x80, 0x80 }
+#define ROW_RGBA(i) { SHUFFLE_RGBA((i) & 3), SHUFFLE_RGBA((i) >> 2 & 3), SHUFFLE_RGBA((i) >> 4 & 3), SHUFFLE_RGBA((i) >> 6 & 3) }
+#define ROWS_4(R, i) R(i), R(i + 1), R(i + 2), R(i + 3)
+#define ROWS_16(R, i) ROWS_4(R, i), ROWS_4(R, i + 4), ROWS_4(R, i + 8), ROWS_4(R, i + 12)
+#define ROWS_64(R, i) ROWS_16(R, i), ROWS_16(R, i + 16), ROWS_16(R, i + 32), ROWS_16(R, i + 48)
+#define ROWS_256(R) { ROWS_64(R, 0), ROWS_64(R, 64), ROWS_64(R, 128), ROWS_64(R, 192) }
+
+static const unsigned char rgb_shuffles[256][16] = ROWS_256(ROW_RGB);
+static const unsigned char rgba_shuffles[256][16] = ROWS_256(ROW_RGBA);
+
+__attribute__((target("ssse3")))
+static void expand_rgb_ssse3(unsigned char *dest, int pitch, const Block *block)
+{
+    const __m128i colors = _mm_setr_epi32(block->colors[0], block->colors[1], block->colors[2], block->colors[3]);
+    int y;
+
+    for (y = 0; y < 4; y++, dest += pitch)
+    {
+        const unsigned char *shuffle = rgb_shuffles[(block->indices >> (8 * y)) & 0xff];
+        __m128i row = _mm_shuffle_epi8(colors, _mm_loadu_si128((const __m128i *) shuffle));
+        int high = _mm_cvtsi128_si32(_mm_srli_si128(row, 8));
+
+        _mm_storel_epi64((__m128i *) dest, row);
+        memcpy(dest + 8, &high, 4);
+    }
+}
+
+// The alphas go into the colors' zeroed alpha bytes, through a shuffle whose other
+// bytes have their top bit set, which zeroes them.
+__attribute__((target("ssse3")))
+static void expand_rgba_ssse3(unsigned char *dest, int pitch, const Block *block)
+{
+    const __m128i colors = _mm_setr_epi32(block->colors[0], block->colors[1], block->colors[2], block->colors[3]);
+    const __m128i alphas = _mm_set_epi64x(0, (long long) block->alphas);
+    unsigned long long codes = block->alpha_indices;
+    int y;
+
+    for (y = 0; y < 4; y++, dest += pitch, codes >>= 12)
+    {
+        const unsigned char *shuffle = rgba_shuffles[(block->indices >> (8 * y)) & 0xff];
+        __m128i row = _mm_shuffle_epi8(colors, _mm_loadu_si128((const __m128i *) shuffle));
+        __m128i mask = _mm_setr_epi32(
+            0x808080 | (int) (codes & 7) << 24,
+            0x808080 | (int) (codes >> 3 & 7) << 24,
+            0x808080 | (int) (codes >> 6 & 7) << 24,
+            0x808080 | (int) (codes >> 9 & 7) << 24);
+
+        _mm_storeu_si128((__m128i *) dest, _mm_or_si128(row, _mm_shuffle_epi8(alphas, mask)));
+    }
+}
+
+#endif
+
+static Expand pick_expand(int channels)
+{
+#ifdef SIMD_X86
+    if (__builtin_cpu_supports("ssse3"))
+        return channels == 4 ? expand_rgba_ssse3 : expand_rgb_ssse3;
+#endif
+    return channels == 4 ? expand_rgba : expand_rgb;
+}
+
+// Blocks that overhang the right or bottom edge are expanded aside, then clipped.
+static void expand_block(Expand expand, unsigned char *dest, int pitch, int channels,
+                         int cols, int rows, const Block *block)
+{
+    unsigned char edge[4 * 16];
+    int y;
+
+    if (cols >= 4 && rows >= 4)
+    {
+        expand(dest, pitch, block);
+        return;
+    }
+
+    expand(edge, 16, block);
+    for (y = 0; y < min(rows, 4); y++)
+        memcpy(dest + y * pitch, edge + y * 16, min(cols, 4) * channels);
 }
 
 void decode_dxt1(int width, int height, unsigned char *dest, const char **p6)
 {
+    Expand expand = pick_expand(3);
     int horzBlocks = (width + 3) >> 2;
     int vertBlocks = (height + 3) >> 2;
+    int rowSize = width * 3;
     unsigned char *src;
-    unsigned char *pDest = dest;
     unsigned char *pBlock;
-    int rowSize = width * 3;
-    int size = rowSize * height;
-    unsigned short rgb0, rgb1;
-    unsigned int bits;
-    unsigned char code;
-    int linear0, linear1, linear2, linear3;
-    int blockRow, blockCol, x, y;
+    Block block;
+    int blockRow, blockCol;
     int srcSize;
 
+    TRACE_BEGIN("decode_dxt1");
     pBlock = src = (unsigned char *) malloc(1 + 8 * horzBlocks * vertBlocks);
     srcSize = decode(src, p6);
     assert(srcSize == 8 * horzBlocks * vertBlocks);
 
-    for (blockRow = 0, linear0 = 0; blockRow < vertBlocks; ++blockRow, linear0 += rowSize << 2)
+    for (blockRow = 0; blockRow < vertBlocks; ++blockRow)
     {
-        for (blockCol = 0, linear1 = linear0; blockCol < horzBlocks; ++blockCol, linear1 += 12)
+        for (blockCol = 0; blockCol < horzBlocks; ++blockCol, pBlock += 8)
         {
-            rgb0 = *(pBlock++);
-            rgb0 |= *(pBlock++) << 8;
-            rgb1 = *(pBlock++);
-            rgb1 |= *(pBlock++) << 8;
-            bits = *((unsigned int *) pBlock);
-            for (y = 0, linear2 = linear1; y < 4 && linear2 < size; ++y, linear2 += rowSize)
-            {
-                for (x = 0, linear3 = linear2; x < min(width, 4); ++x, linear3 += 3)
-                {
-                    code = bits & 0x3;
-                    decode_dxt(pDest + linear3, code, rgb0, rgb1, 0, rgb0 > rgb1);
-                    bits >>= 2;
-                }
-            }
-            pBlock += 4;
+            color_block(&block, pBlock, 0);
+            expand_block(expand, dest + blockRow * 4 * rowSize + blockCol * 12, rowSize, 3,
+                         width - blockCol * 4, height - blockRow * 4, &block);
         }
     }
 
     free(src);
+    TRACE_END("decode_dxt1");
 }
 
 void decode_dxt5(int width, int height, unsigned char *dest, const char **p6)
 {
-    unsigned char *src;
-    unsigned char *pDest = dest;
-    unsigned char *pBlock;
+    Expand expand = pick_expand(4);
     int horzBlocks = (width + 3) >> 2;
     int vertBlocks = (height + 3) >> 2;
     int rowSize = width * 4;
-    int size = rowSize * height;
-    unsigned short rgb0, rgb1;
-    unsigned int bits;
-    unsigned char code, alp0, alp1, bit;
-    int linear0, linear1, linear2, linear3;
-    int blockRow, blockCol, x, y;
-    int srcSize;
+    unsigned char *src;
+    unsigned char *pBlock;
+    Block block;
+    int blockRow, blockCol;
 
+    TRACE_BEGIN("decode_dxt5");
     pBlock = src = (unsigned char *) malloc(1 + 16 * horzBlocks * vertBlocks);
-    srcSize = decode(src, p6);
+    decode(src, p6);
 
-    for (blockRow = 0, linear0 = 0; blockRow < vertBlocks; ++blockRow, linear0 += rowSize << 2)
+    for (blockRow = 0; blockRow < vertBlocks; ++blockRow)
     {
-        for (blockCol = 0, linear1 = linear0; blockCol < horzBlocks; ++blockCol, linear1 += 16)
+        for (blockCol = 0; blockCol < horzBlocks; ++blockCol, pBlock += 16)
         {
-            // Alpha block
-            alp0 = *(pBlock++);
-            alp1 = *(pBlock++);
-            bit = 2;
-            for (y = 0, linear2 = linear1; y < 4 && linear2 < size; ++y, linear2 += rowSize)
-            {
-                for (x = 0, linear3 = linear2 + 3; x < min(width, 4); ++x, linear3 += 4)
-                {
-                    code  = (pBlock[bit >> 3] >> (bit & 0x7)) & 1; bit--; code <<= 1;
-                    code |= (pBlock[bit >> 3] >> (bit & 0x7)) & 1; bit--; code <<= 1;
-                    code |= (pBlock[bit >> 3] >> (bit & 0x7)) & 1;
-                    pDest[linear3] = decode_latc(code, alp0, alp1, 0, 255);
-                    bit += 5;
-                }
-            }
-            pBlock += 6;
-
-            // RGB block
-            rgb0 = *(pBlock++);
-            rgb0 |= *(pBlock++) << 8;
-            rgb1 = *(pBlock++);
-            rgb1 |= *(pBlock++) << 8;
-            bits = *((unsigned int *) pBlock);
-            for (y = 0, linear2 = linear1; y < 4 && linear2 < size; ++y, linear2 += rowSize)
-            {
-                for (x = 0, linear3 = linear2; x < min(width, 4); ++x, linear3 += 4)
-                {
-                    code = bits & 0x3;
-                    decode_dxt(pDest + linear3, code, rgb0, rgb1, 0, 1);
-                    bits >>= 2;
-                }
-            }
-            pBlock += 4;
+            alpha_block(&block, pBlock);
+            color_block(&block, pBlock + 8, 1);
+            expand_block(expand, dest + blockRow * 4 * rowSize + blockCol * 16, rowSize, 4,
+                         width - blockCol * 4, height - blockRow * 4, &block);
         }
     }
+
+    free(src);
+    TRACE_END("decode_dxt5");
 }
@@ -0,0 +1,179 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// The pool has a worker for each other core, up to one fewer than the jobs it can
+// hold, since the calling thread works too.  One lock guards the queue, which is only
+// touched between jobs.  There are no workers on Windows, where the caller runs every
+// job in turn.
+
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "os.h"
+#include "loader.h"
+#include "trace.h"
+
+typedef enum
+{
+    EJobQueued,
+    EJobRunning,
+    EJobDone,
+    EJobReturned,
+} JobState;
+
+typedef struct
+{
+    LoaderJob job;
+    void *data;
+    JobState state;
+} Job;
+
+struct LoaderRec
+{
+    Job *jobs;
+    int capacity;
+    int count;
+    int queued;         // the first job no thread has taken
+    int returned;
+    int closing;
+    int worker_count;
+#ifndef WIN32
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+};
+
+#ifdef WIN32
+#define LOCK(loader)
+#define UNLOCK(loader)
+#define WAIT(loader)
+#define BROADCAST(loader)
+#else
+#define LOCK(loader) pthread_mutex_lock(&(loader)->lock)
+#define UNLOCK(loader) pthread_mutex_unlock(&(loader)->lock)
+#define WAIT(loader) pthread_cond_wait(&(loader)->changed, &(loader)->lock)
+#define BROADCAST(loader) pthread_cond_broadcast(&(loader)->changed)
+static void *work_thread(void *);
+#endif
+
+static int run_job(Loader *loader);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Loader *loader_create(int capacity)
+{
+    Loader *loader = (Loader *) calloc(1, sizeof(Loader));
+    int i;
+
+    loader->jobs = (Job *) calloc(capacity, sizeof(Job));
+    loader->capacity = capacity;
+#ifndef WIN32
+    loader->worker_count = max(0, min((int) sysconf(_SC_NPROCESSORS_ONLN), capacity) - 1);
+    loader->workers = (pthread_t *) malloc(max(1, loader->worker_count) * sizeof(pthread_t));
+    pthread_mutex_init(&loader->lock, 0);
+    pthread_cond_init(&loader->changed, 0);
+    for (i = 0; i < loader->worker_count; i++)
+        pthread_create(loader->workers + i, 0, work_thread, loader);
+#endif
+    return loader;
+}
+
+// Jobs still queued are dropped; running ones are waited for.
+void loader_destroy(Loader *loader)
+{
+    int i;
+
+    LOCK(loader);
+    loader->closing = 1;
+    BROADCAST(loader);
+    UNLOCK(loader);
+#ifndef WIN32
+    for (i = 0; i < loader->worker_count; i++)
+        pthread_join(loader->workers[i], 0);
+    pthread_cond_destroy(&loader->changed);
+    pthread_mutex_destroy(&loader->lock);
+    free(loader->workers);
+#endif
+    free(loader->jobs);
+    free(loader);
+}
+
+int loader_add(Loader *loader, LoaderJob job, void *data)
+{
+    int index;
+
+    LOCK(loader);
+    assert(loader->count < loader->capacity);
+    index = loader->count++;
+    loader->jobs[index].job = job;
+    loader->jobs[index].data = data;
+    loader->jobs[index].state = EJobQueued;
+    BROADCAST(loader);
+    UNLOCK(loader);
+    return index;
+}
+
+int loader_next(Loader *loader)
+{
+    int i, index = -1;
+
+    LOCK(loader);
+    while (index < 0 && loader->returned < loader->count)
+    {
+        for (i = 0; i < loader->count && loader->jobs[i].state != EJobDone; i++)
+            ;
+        if (i < loader->count)
+            index = i;
+        else if (loader->queued < loader->count)
+            index = run_job(loader);
+        else
+            WAIT(loader);
+    }
+    if (index >= 0)
+    {
+        loader->jobs[index].state = EJobReturned;
+        loader->returned++;
+    }
+    UNLOCK(loader);
+    return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Takes the next queued job and runs it outside the lock, which the caller holds.
+static int run_job(Loader *loader)
+{
+    int index = loader->queued++;
+    Job *job = loader->jobs + index;
+
+    job->state = EJobRunning;
+    UNLOCK(loader);
+    job->job(job->data);
+    LOCK(loader);
+    job->state = EJobDone;
+    BROADCAST(loader);
+    return index;
+}
+
+#ifndef WIN32
+
+static void *work_thread(void *data)
+{
+    Loader *loader = (Loader *) data;
+
+    TRACE_THREAD("loader");
+    LOCK(loader);
+    while (!loader->closing)
+    {
+        if (loader->queued < loader->count)
+            run_job(loader);
+        else
+            WAIT(loader);
+    }
+    UNLOCK(loader);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,20 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+
+// Runs jobs on a pool of worker threads and hands each back to the calling thread once
+// it's done, so that whatever has to follow on that thread, like a GL upload, can start
+// as soon as its own job finishes.  Jobs are added with loader_add, and loader_next
+// returns the index of a finished job, in the order they finish, or -1 once every job
+// has been returned.  While nothing is finished the caller runs queued jobs itself, so
+// a machine with one core gets through them all without threads.
+
+typedef void (*LoaderJob)(void *data);
+
+typedef struct LoaderRec Loader;
+
+Loader *loader_create(int capacity);
+void    loader_destroy(Loader *);
+int     loader_add(Loader *, LoaderJob job, void *data);
+int     loader_next(Loader *);
@@ -3,6 +3,20 @@
 
 #include "os.h"
 #include "game.h"
+#include "draw.h"
+#include "profile.h"
+#include "trace.h"
+#include "replay.h"
+
+// With '-record <file>', every button is logged against the number of updates so far,
+// for replaying with tetrita-export.  With '-dirty', only the parts of the view that
+// changed since the previous frame are repainted.  With '-scale <n>', the window starts
+// at n pixels per view unit; resizing it picks the largest scale that fits.
+static Replay *g_replay = 0;
+static unsigned int g_updates = 0;
+
+static void press(Game *game, Button button);
+static void release(Game *game, Button button);
 
 int main(int argc, char** argv)
 {
@@ -13,10 +27,29 @@ int main(int argc, char** argv)
     OS_Event event;
     Game *game;
     GameState state;
+    unsigned int seed = (unsigned) time(0);
+    int i;
+#ifdef PROFILE
+    unsigned long long inputTime = 0;
+#endif
 
-    osInit("Tetrita" , VIEW_WIDTH, VIEW_HEIGHT, OS_OVERLAY, 0);
+    TRACE_THREAD("main");
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-dirty"))
+            draw_partial(1);
+        else if (!strcmp(argv[i], "-scale") && i + 1 < argc)
+            draw_scale(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-record") && i + 1 < argc && !(g_replay = replay_record(argv[++i], seed)))
+            fatalf("Error: couldn't write %s\n", argv[i]);
+    }
+#ifdef CORE_PROFILE
+    osInit("Tetrita" , VIEW_WIDTH, VIEW_HEIGHT, OS_OVERLAY | OS_RESIZABLE | OS_CORE, 0);
+#else
+    osInit("Tetrita" , VIEW_WIDTH, VIEW_HEIGHT, OS_OVERLAY | OS_RESIZABLE, 0);
+#endif
     osWaitVsync(1);
-    srand((unsigned) time(0));
+    srand(seed);
     game = game_create();
 
     currentTime = osGetMilliseconds();
@@ -25,6 +58,7 @@ int main(int argc, char** argv)
     while (game_state(game) != EDone)
     {
         int moved = 0;
+        PROFILE_BEGIN(EPhaseEvents);
         while (osPollEvent(&event))
         {
             state = game_state(game);
@@ -40,7 +74,7 @@ int main(int argc, char** argv)
                 case OS_DEACTIVATE:
                     if (state == EPaused)
                         break;
-                    game_release(game, EPause);
+                    release(game, EPause);
                     game_draw(game);
                     osSwapBuffers();
                     break;
@@ -69,32 +103,44 @@ int main(int argc, char** argv)
                     break;
 
                 case OS_ACTIVATE:
-                    game_press(game, EPause);
+                    press(game, EPause);
+                    break;
+
+                case OS_RESIZE:
+                    draw_scale(min(event.resize.width / BASE_WIDTH, event.resize.height / BASE_HEIGHT));
+                    if (state != EPaused)
+                        break;
+                    game_draw(game);
+                    osSwapBuffers();
                     break;
 
                 case OS_KEYDOWN:
+#ifdef PROFILE
+                    if (!inputTime)
+                        inputTime = event.timestamp;
+#endif
                     switch (event.key.key)
                     {
                         case OSK_DOWN:
                         case OSK_NUMPAD2:
                         case '2':
-                            game_press(game, EAccelerate);
+                            press(game, EAccelerate);
                             break;
                         case OSK_NEXT:
                         case OSK_NUMPAD3:
                         case ' ':
                         case '3':
-                            game_press(game, ESlam);
+                            press(game, ESlam);
                             break;
                         case OSK_NUMPAD4:
                         case OSK_LEFT:
                         case '4':
-                            game_press(game, ELeft);
+                            press(game, ELeft);
                             break;
                         case OSK_NUMPAD6:
                         case OSK_RIGHT:
                         case '6':
-                            game_press(game, ERight);
+                            press(game, ERight);
                             break;
                         case OSK_NUMPAD8:
                         case OSK_NUMPAD5:
@@ -102,33 +148,43 @@ int main(int argc, char** argv)
                         case OSK_UP:
                         case '8':
                         case '5':
-                            game_press(game, ERotate);
+                            press(game, ERotate);
                             break;
                         case 'x': case 'X': case 'q': case 'Q':
                         case OSK_ESCAPE:
-                            game_press(game, EQuit);
+                            press(game, EQuit);
+                            break;
+#ifdef PROFILE
+                        case 'p': case 'P':
+                            profile_toggle();
                             break;
+#endif
+#ifdef TRACE
+                        case 't': case 'T':
+                            TRACE_DUMP(TRACE_FILENAME);
+                            break;
+#endif
                     }
                     break;
 
                 case OS_KEYUP:
-                    game_release(game, EAny);
+                    release(game, EAny);
                     switch (event.key.key)
                     {
                         case OSK_DOWN:
                         case OSK_NUMPAD2:
                         case '2':
-                            game_release(game, EAccelerate);
+                            release(game, EAccelerate);
                             break;
                         case OSK_NUMPAD4:
                         case OSK_LEFT:
                         case '4':
-                            game_release(game, ELeft);
+                            release(game, ELeft);
                             break;
                         case OSK_NUMPAD6:
                         case OSK_RIGHT:
                         case '6':
-                            game_release(game, ERight);
+                            release(game, ERight);
                             break;
                         case OSK_NUMPAD8:
                         case OSK_NUMPAD5:
@@ -136,37 +192,78 @@ int main(int argc, char** argv)
                         case OSK_UP:
                         case '8':
                         case '5':
-                            game_release(game, ERotate);
+                            release(game, ERotate);
                             break;
                         case 'y': case 'Y':
-                            game_release(game, EYes);
+                            release(game, EYes);
                             break;
                         case 'n': case 'N':
                             if (state == EEndQuery)
-                                game_press(game, EQuit);
+                                press(game, EQuit);
                             break;
                     }
                     break;
 
                 case OS_QUIT:
-                    game_press(game, EQuit);
+                    press(game, EQuit);
                     break;
 
             }
         }
+        PROFILE_END(EPhaseEvents);
 
         state = game_state(game);
         currentTime = osGetMilliseconds();
         if (state != EPaused && state != EDone && currentTime - previousDrawTime > drawDelay)
         {
+            PROFILE_BEGIN(EPhaseUpdate);
+            TRACE_BEGIN("update");
             game_update(game);
+            g_updates++;
+            TRACE_END("update");
+            PROFILE_END(EPhaseUpdate);
+            PROFILE_BEGIN(EPhaseDraw);
+            TRACE_BEGIN("draw");
             game_draw(game);
+            TRACE_END("draw");
+            PROFILE_END(EPhaseDraw);
+            PROFILE_BEGIN(EPhaseSwap);
+            TRACE_BEGIN("swap");
             osSwapBuffers();
+            TRACE_END("swap");
+            PROFILE_END(EPhaseSwap);
+#ifdef PROFILE
+            if (inputTime)
+            {
+                PROFILE_SAMPLE(EPhaseLatency, (unsigned int) (osGetMicroseconds() - inputTime));
+                inputTime = 0;
+            }
+#endif
+            PROFILE_FRAME();
             previousDrawTime = currentTime;
         }
     }
 
+    TRACE_DUMP(TRACE_FILENAME);
+    if (g_replay)
+        replay_close(g_replay, g_updates);
     game_destroy(game);
     osQuit();
     return 0;
 }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void press(Game *game, Button button)
+{
+    if (g_replay)
+        replay_event(g_replay, g_updates, 1, button);
+    game_press(game, button);
+}
+
+static void release(Game *game, Button button)
+{
+    if (g_replay)
+        replay_event(g_replay, g_updates, 0, button);
+    game_release(game, button);
+}
@@ -0,0 +1,433 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// A headless OS layer: the GL context comes from EGL, without a window or an X
+// display, and everything is drawn into a framebuffer object.  On Mesa the surfaceless
+// platform needs neither a GPU nor a display server, so the real renderers can run in
+// CI and automated performance runs.  Build with 'make OS=egl'.
+//
+// Input is a script read from stdin, one event per line:
+//
+//     <frame> down <key>
+//     <frame> up <key>
+//     <frame> quit
+//
+// where a key is a single character or one of left, right, up, down, next, space and
+// escape, and blank lines and lines starting with '#' are skipped.  Time only passes
+// when the event queue runs dry, a frame period at a time, so the main loop runs one
+// update per pass and events land on the frame numbered in the script however fast
+// the machine is.  When the script runs out, the game is asked to quit.
+
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <ctype.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "os.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER          0x8D40
+#define GL_RENDERBUFFER         0x8D41
+#define GL_COLOR_ATTACHMENT0    0x8CE0
+#define GL_DEPTH_ATTACHMENT     0x8D00
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+
+#ifndef GL_RGB8
+#define GL_RGB8                 0x8051
+#define GL_RGBA8                0x8058
+#endif
+
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24    0x81A6
+#endif
+
+#define SCRIPT_CAPACITY 64
+
+// Just over the main loop's 60 Hz draw delay.
+#define FRAME_MILLISECONDS 17
+
+typedef void (APIENTRY *GenProc)(GLsizei count, GLuint *names);
+typedef void (APIENTRY *DeleteProc)(GLsizei count, const GLuint *names);
+typedef void (APIENTRY *BindProc)(GLenum target, GLuint name);
+typedef void (APIENTRY *RenderbufferStorageProc)(GLenum target, GLenum format, GLsizei width, GLsizei height);
+typedef void (APIENTRY *FramebufferRenderbufferProc)(GLenum target, GLenum attachment, GLenum renderbuffer_target, GLuint renderbuffer);
+typedef GLenum (APIENTRY *CheckFramebufferStatusProc)(GLenum target);
+
+typedef struct
+{
+    unsigned int frame;
+    OS_Event event;
+} ScriptEvent;
+
+static EGLDisplay g_display = EGL_NO_DISPLAY;
+static EGLContext g_context = EGL_NO_CONTEXT;
+static EGLSurface g_surface = EGL_NO_SURFACE;
+static int g_width;
+static int g_height;
+
+// The offscreen framebuffer, when the context has no surface to draw into.
+static GLuint g_framebuffer;
+static GLuint g_renderbuffers[2];
+
+// The script is read a few events ahead of the clock.
+static ScriptEvent g_script[SCRIPT_CAPACITY];
+static int g_scriptHead = 0;
+static int g_scriptCount = 0;
+static int g_scriptLine = 0;
+static int g_scriptDone = 0;
+static unsigned int g_frame = 0;
+static unsigned int g_clock = 0;
+
+PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC glCompressedTexSubImage2D = 0;
+PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2D = 0;
+PFNGLGENBUFFERSPROC glGenBuffers = 0;
+PFNGLDELETEBUFFERSPROC glDeleteBuffers = 0;
+PFNGLBINDBUFFERPROC glBindBuffer = 0;
+PFNGLBUFFERDATAPROC glBufferData = 0;
+
+static EGLDisplay open_display();
+static void create_framebuffer(unsigned int flags);
+static void load_extensions();
+static void read_script();
+static int parse_key(const char *name);
+
+void osInit(const char *name, int width, int height, unsigned int flags, int *attribs)
+{
+    EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 1,
+        EGL_GREEN_SIZE, 1,
+        EGL_BLUE_SIZE, 1,
+        EGL_NONE,
+    };
+
+    EGLint core_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE,
+    };
+
+    EGLint pbuffer_attribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE,
+    };
+
+    const char *extensions;
+    EGLConfig config;
+    EGLint count = 0;
+
+    atexit(osQuit);
+    g_width = width;
+    g_height = height;
+
+    g_display = open_display();
+    if (g_display == EGL_NO_DISPLAY || !eglInitialize(g_display, 0, 0))
+        fatalf("Error: couldn't open an EGL display\n");
+    if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(g_display, config_attribs, &config, 1, &count) || !count)
+        fatalf("Error: couldn't find an EGL configuration for OpenGL\n");
+
+    g_context = eglCreateContext(g_display, config, EGL_NO_CONTEXT, (flags & OS_CORE) ? core_attribs : 0);
+    if (g_context == EGL_NO_CONTEXT)
+        fatalf("Error: couldn't create an OpenGL%s context\n", (flags & OS_CORE) ? " 3.3 core" : "");
+
+    // Without surfaceless contexts, a pbuffer stands in for the window.
+    extensions = eglQueryString(g_display, EGL_EXTENSIONS);
+    if (extensions && strstr(extensions, "EGL_KHR_surfaceless_context"))
+    {
+        eglMakeCurrent(g_display, EGL_NO_SURFACE, EGL_NO_SURFACE, g_context);
+        create_framebuffer(flags);
+    }
+    else
+    {
+        g_surface = eglCreatePbufferSurface(g_display, config, pbuffer_attribs);
+        if (g_surface == EGL_NO_SURFACE)
+            fatalf("Error: couldn't create an EGL pbuffer\n");
+        eglMakeCurrent(g_display, g_surface, g_surface, g_context);
+    }
+
+    // Core contexts have no GL_EXTENSIONS string; the core backend loads its own entry points.
+    if (!(flags & OS_CORE))
+        load_extensions();
+}
+
+void osQuit(void)
+{
+    if (g_display == EGL_NO_DISPLAY)
+        return;
+
+    if (g_framebuffer)
+    {
+        DeleteProc glDeleteFramebuffers = (DeleteProc) osGetProcAddress("glDeleteFramebuffers");
+        DeleteProc glDeleteRenderbuffers = (DeleteProc) osGetProcAddress("glDeleteRenderbuffers");
+        glDeleteFramebuffers(1, &g_framebuffer);
+        glDeleteRenderbuffers(2, g_renderbuffers);
+        g_framebuffer = 0;
+    }
+
+    eglMakeCurrent(g_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(g_display, g_context);
+    if (g_surface != EGL_NO_SURFACE)
+        eglDestroySurface(g_display, g_surface);
+    eglTerminate(g_display);
+    g_display = EGL_NO_DISPLAY;
+}
+
+int osGetScreenWidth()
+{
+    return g_width;
+}
+
+int osGetScreenHeight()
+{
+    return g_height;
+}
+
+void osWaitVsync(int interval)
+{
+}
+
+unsigned int osGetMilliseconds()
+{
+    return g_clock;
+}
+
+unsigned long long osGetMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int osPollEvent(struct OS_EventRec *e)
+{
+    if (g_scriptHead == g_scriptCount && !g_scriptDone)
+        read_script();
+
+    if (g_scriptHead < g_scriptCount && g_script[g_scriptHead].frame <= g_frame)
+    {
+        *e = g_script[g_scriptHead++].event;
+        e->timestamp = osGetMicroseconds();
+        return 1;
+    }
+
+    if (g_scriptHead == g_scriptCount && g_scriptDone == 1)
+    {
+        memset(e, 0, sizeof(OS_Event));
+        e->type = OS_QUIT;
+        e->timestamp = osGetMicroseconds();
+        g_scriptDone = 2;
+        return 1;
+    }
+
+    // The queue is dry: move on to the next frame.
+    g_clock += FRAME_MILLISECONDS;
+    g_frame++;
+    return 0;
+}
+
+// Nothing is shown, but waiting for the frame keeps the CPU from running arbitrarily
+// far ahead of the GPU, as a swap would.
+void osSwapBuffers()
+{
+    if (g_surface != EGL_NO_SURFACE)
+        eglSwapBuffers(g_display, g_surface);
+    glFinish();
+}
+
+// Neither the framebuffer nor the single-buffered pbuffer is ever swapped away, so it
+// always holds the previous frame.
+int osBufferAge()
+{
+    return 1;
+}
+
+void *osGetProcAddress(const char *name)
+{
+    return (void *) eglGetProcAddress(name);
+}
+
+// Shows a frame rendered on the CPU, bottom row first.  The software renderer never
+// touches the matrices, so the raster position maps to the lower-left corner.
+void osPresent(const unsigned char *rgba, int width, int height)
+{
+    glRasterPos2f(-1, -1);
+    glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+}
+
+int osShowCursor(int)
+{
+    return 0;
+}
+
+void osGetWindowPos(int *x, int *y)
+{
+    if (x) *x = 0;
+    if (y) *y = 0;
+}
+
+void osMoveWindow(int x, int y)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Mesa's surfaceless platform needs no display server at all; anywhere else, the
+// default display will do.
+static EGLDisplay open_display()
+{
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    EGLDisplay display = EGL_NO_DISPLAY;
+
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless"))
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (eglGetPlatformDisplayEXT)
+            display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+    }
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    return display;
+}
+
+// Stands in for the window's framebuffer, and stays bound for the life of the context.
+// There is no alpha channel unless asked for, like the windowed visuals.
+static void create_framebuffer(unsigned int flags)
+{
+    GenProc glGenFramebuffers = (GenProc) osGetProcAddress("glGenFramebuffers");
+    GenProc glGenRenderbuffers = (GenProc) osGetProcAddress("glGenRenderbuffers");
+    BindProc glBindFramebuffer = (BindProc) osGetProcAddress("glBindFramebuffer");
+    BindProc glBindRenderbuffer = (BindProc) osGetProcAddress("glBindRenderbuffer");
+    RenderbufferStorageProc glRenderbufferStorage = (RenderbufferStorageProc) osGetProcAddress("glRenderbufferStorage");
+    FramebufferRenderbufferProc glFramebufferRenderbuffer = (FramebufferRenderbufferProc) osGetProcAddress("glFramebufferRenderbuffer");
+    CheckFramebufferStatusProc glCheckFramebufferStatus = (CheckFramebufferStatusProc) osGetProcAddress("glCheckFramebufferStatus");
+
+    if (!glGenFramebuffers || !glGenRenderbuffers || !glBindFramebuffer || !glBindRenderbuffer ||
+        !glRenderbufferStorage || !glFramebufferRenderbuffer || !glCheckFramebufferStatus)
+    {
+        fatalf("Error: framebuffer objects are unavailable\n");
+    }
+
+    glGenFramebuffers(1, &g_framebuffer);
+    glGenRenderbuffers(2, g_renderbuffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, g_renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, (flags & OS_ALPHA) ? GL_RGBA8 : GL_RGB8, g_width, g_height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, g_renderbuffers[0]);
+    if (flags & OS_DEPTH)
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, g_renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, g_width, g_height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_renderbuffers[1]);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fatalf("Error: couldn't create a %dx%d framebuffer\n", g_width, g_height);
+    glViewport(0, 0, g_width, g_height);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+static void load_extensions()
+{
+    if (strstr((const char *) glGetString(GL_EXTENSIONS), "GL_EXT_texture_compression_s3tc"))
+    {
+        glCompressedTexSubImage2D = (PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC) eglGetProcAddress("glCompressedTexSubImage2D");
+        glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC) eglGetProcAddress("glCompressedTexImage2D");
+    }
+
+    // EGL postdates buffer objects becoming core.
+    glGenBuffers = (PFNGLGENBUFFERSPROC) eglGetProcAddress("glGenBuffers");
+    glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) eglGetProcAddress("glDeleteBuffers");
+    glBindBuffer = (PFNGLBINDBUFFERPROC) eglGetProcAddress("glBindBuffer");
+    glBufferData = (PFNGLBUFFERDATAPROC) eglGetProcAddress("glBufferData");
+}
+
+// Refills the queue from stdin; g_scriptDone becomes 1 at the end of the script.
+static void read_script()
+{
+    char line[256], action[16], key[16];
+    unsigned int frame;
+    int fields;
+
+    g_scriptHead = g_scriptCount = 0;
+    while (g_scriptCount < SCRIPT_CAPACITY && fgets(line, sizeof(line), stdin))
+    {
+        ScriptEvent *event = g_script + g_scriptCount;
+        char *text = line;
+
+        g_scriptLine++;
+        while (isspace((unsigned char) *text))
+            text++;
+        if (!*text || *text == '#')
+            continue;
+
+        fields = sscanf(text, "%u %15s %15s", &frame, action, key);
+        memset(event, 0, sizeof(ScriptEvent));
+        event->frame = frame;
+        if (fields == 2 && !strcmp(action, "quit"))
+        {
+            event->event.type = OS_QUIT;
+        }
+        else if (fields == 3 && (!strcmp(action, "down") || !strcmp(action, "up")))
+        {
+            int down = !strcmp(action, "down");
+            event->event.type = down ? OS_KEYDOWN : OS_KEYUP;
+            event->event.key.state = down ? OSKS_DOWN : OSKS_UP;
+            event->event.key.key = (unsigned char) parse_key(key);
+        }
+        else
+        {
+            fatalf("Error: can't read line %d of the input script\n", g_scriptLine);
+        }
+        g_scriptCount++;
+    }
+
+    if (g_scriptCount < SCRIPT_CAPACITY)
+        g_scriptDone = 1;
+}
+
+static int parse_key(const char *name)
+{
+    static const struct
+    {
+        const char *name;
+        int key;
+    }
+    keys[] =
+    {
+        "left",   OSK_LEFT,
+        "right",  OSK_RIGHT,
+        "up",     OSK_UP,
+        "down",   OSK_DOWN,
+        "next",   OSK_NEXT,
+        "space",  ' ',
+        "escape", OSK_ESCAPE,
+    };
+    int i;
+
+    for (i = 0; i < (int) (sizeof(keys) / sizeof(keys[0])); i++)
+    {
+        if (!strcmp(name, keys[i].name))
+            return keys[i].key;
+    }
+    if (name[0] && !name[1])
+        return (unsigned char) name[0];
+    fatalf("Error: unknown key '%s' on line %d of the input script\n", name, g_scriptLine);
+    return 0;
+}
@@ -19,8 +19,12 @@ int osGetScreenWidth();
 int osGetScreenHeight();
 void osWaitVsync(int);
 unsigned int osGetMilliseconds();
+unsigned long long osGetMicroseconds();
 int osPollEvent(struct OS_EventRec *e);
 void osSwapBuffers();
+int osBufferAge();
+void osPresent(const unsigned char *rgba, int width, int height);
+void *osGetProcAddress(const char *name);
 int osShowCursor(int);
 void osGetWindowPos(int *, int *);
 void osMoveWindow(int, int);
@@ -78,6 +82,7 @@ void debugf(const char *format, ...);
 #define OS_OVERLAY     0x00000040
 #define OS_DEPTH       0x00000080
 #define OS_ALPHA       0x00000100
+#define OS_CORE        0x00000200
 
 typedef enum
 {
@@ -116,6 +121,7 @@ typedef struct OS_EventRec
 {
     OS_EventType type;
     struct OS_EventRec *next;
+    unsigned long long timestamp;
     union
     {
         OS_KeyboardEvent key;
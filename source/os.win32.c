@@ -6,8 +6,24 @@
 #include "GL/glext.h"
 #include "GL/wglext.h"
 
+// http://opengl.org/registry/specs/ARB/wgl_create_context.txt
+#ifndef WGL_ARB_create_context
+#define WGL_CONTEXT_MAJOR_VERSION_ARB 0x2091
+#define WGL_CONTEXT_MINOR_VERSION_ARB 0x2092
+typedef HGLRC (WINAPI * PFNWGLCREATECONTEXTATTRIBSARBPROC) (HDC hDC, HGLRC hShareContext, const int *attribList);
+#endif
+
+#ifndef WGL_ARB_create_context_profile
+#define WGL_CONTEXT_PROFILE_MASK_ARB 0x9126
+#define WGL_CONTEXT_CORE_PROFILE_BIT_ARB 0x00000001
+#endif
+
 PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC glCompressedTexSubImage2D = 0;
 PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2D = 0;
+PFNGLGENBUFFERSPROC glGenBuffers = 0;
+PFNGLDELETEBUFFERSPROC glDeleteBuffers = 0;
+PFNGLBINDBUFFERPROC glBindBuffer = 0;
+PFNGLBUFFERDATAPROC glBufferData = 0;
 
 static PFNWGLSWAPINTERVALEXTPROC wglSwapInterval = 0;
 
@@ -17,6 +33,7 @@ static OS_Event *g_eventHead = 0;
 static OS_Event **g_eventTail = &g_eventHead;
 static HWND g_hWnd;
 static int g_cursorVisible = 1;
+static LARGE_INTEGER g_frequency;
 
 int main(int argc, char **argv);
 
@@ -162,6 +179,7 @@ static LRESULT CALLBACK WinProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
     if (e.type)
     {
         e.next = 0;
+        e.timestamp = osGetMicroseconds();
         *g_eventTail = (OS_Event *) malloc(sizeof(OS_Event));
         memcpy(*g_eventTail, &e, sizeof(OS_Event));
         g_eventTail = &((*g_eventTail)->next);
@@ -185,6 +203,8 @@ void osInit(const char *name, int width, int height, unsigned int flags, int *at
         g_hInstance, LoadIcon(g_hInstance, "IDI_APP"), LoadCursor(0, IDC_ARROW), 0, 0, name
     };
 
+    // Before any window exists, as WinProc timestamps the messages sent during creation.
+    QueryPerformanceFrequency(&g_frequency);
     atexit(osQuit);
     RegisterClass(&wndClass);
 
@@ -290,12 +310,53 @@ void osInit(const char *name, int width, int height, unsigned int flags, int *at
         }
     }
 
+    // A core context can only be created through the extension, which needs a current context to load.
+    if (flags & OS_CORE)
+    {
+        PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB =
+            (PFNWGLCREATECONTEXTATTRIBSARBPROC) wglGetProcAddress("wglCreateContextAttribsARB");
+        int context[] =
+        {
+            WGL_CONTEXT_MAJOR_VERSION_ARB, 3,
+            WGL_CONTEXT_MINOR_VERSION_ARB, 3,
+            WGL_CONTEXT_PROFILE_MASK_ARB, WGL_CONTEXT_CORE_PROFILE_BIT_ARB,
+            0, 0
+        };
+        HGLRC core = wglCreateContextAttribsARB ? wglCreateContextAttribsARB(g_hDC, 0, context) : 0;
+
+        if (!core)
+            fatalf("Could not create an OpenGL 3.3 core context.  Is your driver properly installed?");
+        wglMakeCurrent(g_hDC, core);
+        wglDeleteContext(hRC);
+        hRC = core;
+    }
+
     wglSwapInterval = (PFNWGLSWAPINTERVALEXTPROC) wglGetProcAddress("wglSwapIntervalEXT");
 
-    if (strstr(glGetString(GL_EXTENSIONS), "GL_EXT_texture_compression_s3tc"))
+    // Core contexts have no GL_EXTENSIONS string; the core backend loads its own entry points.
+    if (!(flags & OS_CORE))
     {
-        glCompressedTexSubImage2D = (PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC) wglGetProcAddress("glCompressedTexSubImage2D");
-        glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC) wglGetProcAddress("glCompressedTexImage2D");
+        if (strstr(glGetString(GL_EXTENSIONS), "GL_EXT_texture_compression_s3tc"))
+        {
+            glCompressedTexSubImage2D = (PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC) wglGetProcAddress("glCompressedTexSubImage2D");
+            glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC) wglGetProcAddress("glCompressedTexImage2D");
+        }
+
+        // Buffer objects are core in 1.5; older drivers may still expose the ARB extension.
+        if (atof(glGetString(GL_VERSION)) >= 1.5)
+        {
+            glGenBuffers = (PFNGLGENBUFFERSPROC) wglGetProcAddress("glGenBuffers");
+            glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) wglGetProcAddress("glDeleteBuffers");
+            glBindBuffer = (PFNGLBINDBUFFERPROC) wglGetProcAddress("glBindBuffer");
+            glBufferData = (PFNGLBUFFERDATAPROC) wglGetProcAddress("glBufferData");
+        }
+        else if (strstr(glGetString(GL_EXTENSIONS), "GL_ARB_vertex_buffer_object"))
+        {
+            glGenBuffers = (PFNGLGENBUFFERSPROC) wglGetProcAddress("glGenBuffersARB");
+            glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) wglGetProcAddress("glDeleteBuffersARB");
+            glBindBuffer = (PFNGLBINDBUFFERPROC) wglGetProcAddress("glBindBufferARB");
+            glBufferData = (PFNGLBUFFERDATAPROC) wglGetProcAddress("glBufferDataARB");
+        }
     }
 
     timeBeginPeriod(1);
@@ -306,6 +367,14 @@ unsigned int osGetMilliseconds()
     return timeGetTime();
 }
 
+unsigned long long osGetMicroseconds()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long) (counter.QuadPart / g_frequency.QuadPart) * 1000000 +
+           (unsigned long long) (counter.QuadPart % g_frequency.QuadPart) * 1000000 / g_frequency.QuadPart;
+}
+
 int osPollEvent(OS_Event *e)
 {
     MSG msg;
@@ -343,6 +412,25 @@ void osSwapBuffers()
     SwapBuffers(g_hDC);
 }
 
+// WGL can't say what a swap leaves in the back buffer.
+int osBufferAge()
+{
+    return 0;
+}
+
+void *osGetProcAddress(const char *name)
+{
+    return (void *) wglGetProcAddress(name);
+}
+
+// Shows a frame rendered on the CPU, bottom row first.  The software renderer never
+// touches the matrices, so the raster position maps to the lower-left corner.
+void osPresent(const unsigned char *rgba, int width, int height)
+{
+    glRasterPos2f(-1, -1);
+    glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+}
+
 int osShowCursor(int toggle)
 {
     switch (toggle)
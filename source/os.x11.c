@@ -4,25 +4,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <GL/gl.h>
 #include <GL/glext.h>
 #include <GL/glx.h>
 #include <GL/glxext.h>
 #include "os.h"
+#include "trace.h"
+
+// Must be a power of two.
+#define EVENT_CAPACITY 256
 
 static Display *g_display;
 static Window g_window;
 static int g_screen;
 static GLXContext g_context;
 
-static OS_Event *g_eventHead = 0;
-static OS_Event **g_eventTail = &g_eventHead;
+// The input thread owns a second connection to the X server so that it can block
+// in XNextEvent without contending with GLX on the main connection.
+static Display *g_inputDisplay;
+static Atom g_wakeAtom;
+static pthread_t g_inputThread;
+static int g_inputRunning = 0;
+static int g_inputClosing = 0;
+
+// Single-producer single-consumer ring; the input thread writes g_eventTail
+// and the main thread writes g_eventHead.
+static OS_Event g_events[EVENT_CAPACITY];
+static unsigned int g_eventHead = 0;
+static unsigned int g_eventTail = 0;
 
 PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC glCompressedTexSubImage2D = 0;
 PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2D = 0;
+PFNGLGENBUFFERSPROC glGenBuffers = 0;
+PFNGLDELETEBUFFERSPROC glDeleteBuffers = 0;
+PFNGLBINDBUFFERPROC glBindBuffer = 0;
+PFNGLBUFFERDATAPROC glBufferData = 0;
 
 static PFNGLXSWAPINTERVALSGIPROC glXSwapIntervalSGI;
+static int g_bufferAge;
+
+#ifndef GLX_BACK_BUFFER_AGE_EXT
+#define GLX_BACK_BUFFER_AGE_EXT 0x20F4
+#endif
+
+static void load_extensions();
+static void *input_thread(void *);
+static int translate_event(XEvent *event, OS_Event *e);
+static void push_event(const OS_Event *e);
 
 void osInit(const char *name, int width, int height, unsigned int flags, int *attribs)
 {
@@ -36,16 +67,61 @@ void osInit(const char *name, int width, int height, unsigned int flags, int *at
         None,
     };
 
+    int fbattrib[] = {
+        GLX_RENDER_TYPE, GLX_RGBA_BIT,
+        GLX_DRAWABLE_TYPE, GLX_WINDOW_BIT,
+        GLX_DOUBLEBUFFER, True,
+        GLX_RED_SIZE, 1,
+        GLX_GREEN_SIZE, 1,
+        GLX_BLUE_SIZE, 1,
+        None,
+    };
+
+    // http://opengl.org/registry/specs/ARB/glx_create_context.txt
+    int context[] = {
+        GLX_CONTEXT_MAJOR_VERSION_ARB, 3,
+        GLX_CONTEXT_MINOR_VERSION_ARB, 3,
+        GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
+        None,
+    };
+
     XSetWindowAttributes attr;
     unsigned long mask;
     Window root;
     XVisualInfo *visinfo;
+    GLXFBConfig config = 0;
 
+    XInitThreads();
     atexit(osQuit);
     g_display = XOpenDisplay(NULL);
+    g_inputDisplay = XOpenDisplay(NULL);
+    if (!g_display || !g_inputDisplay)
+    {
+        printf("Error: couldn't open X display\n");
+        exit(1);
+    }
+
     g_screen = DefaultScreen(g_display);
     root = RootWindow(g_display, g_screen);
-    visinfo = glXChooseVisual(g_display, g_screen, attrib);
+
+    // Core contexts can only be created from a framebuffer configuration.
+    if (flags & OS_CORE)
+    {
+        int count = 0;
+        GLXFBConfig *configs = glXChooseFBConfig(g_display, g_screen, fbattrib, &count);
+        visinfo = 0;
+        if (configs && count)
+        {
+            config = configs[0];
+            visinfo = glXGetVisualFromFBConfig(g_display, config);
+        }
+        if (configs)
+            XFree(configs);
+    }
+    else
+    {
+        visinfo = glXChooseVisual(g_display, g_screen, attrib);
+    }
 
     if (!visinfo)
     {
@@ -56,7 +132,7 @@ void osInit(const char *name, int width, int height, unsigned int flags, int *at
     attr.background_pixel = 0;
     attr.border_pixel = 0;
     attr.colormap = XCreateColormap(g_display, root, visinfo->visual, AllocNone);
-    attr.event_mask = StructureNotifyMask | ExposureMask | KeyPressMask | KeyReleaseMask;
+    attr.event_mask = 0;
     mask = CWBackPixel | CWBorderPixel | CWColormap | CWEventMask;
 
     g_window = XCreateWindow(
@@ -73,33 +149,71 @@ void osInit(const char *name, int width, int height, unsigned int flags, int *at
 
     XStoreName(g_display, g_window, name);
 
-    g_context = glXCreateContext(g_display, visinfo, NULL, True);
+    // Events are selected on the input connection only; the main connection never reads any.
+    g_wakeAtom = XInternAtom(g_display, "TETRITA_WAKE", False);
+    XSelectInput(g_inputDisplay, g_window, StructureNotifyMask | ExposureMask | KeyPressMask | KeyReleaseMask);
+    XSync(g_display, False);
+    XSync(g_inputDisplay, False);
+
+    if (flags & OS_CORE)
+    {
+        PFNGLXCREATECONTEXTATTRIBSARBPROC glXCreateContextAttribsARB =
+            (PFNGLXCREATECONTEXTATTRIBSARBPROC) glXGetProcAddress((const GLubyte*) "glXCreateContextAttribsARB");
+        g_context = glXCreateContextAttribsARB ? glXCreateContextAttribsARB(g_display, config, NULL, True, context) : 0;
+        if (!g_context)
+            fatalf("Error: couldn't create an OpenGL 3.3 core context\n");
+    }
+    else
+    {
+        g_context = glXCreateContext(g_display, visinfo, NULL, True);
+    }
     glXMakeCurrent(g_display, g_window, g_context);
     XMapWindow(g_display, g_window);
 
     glXSwapIntervalSGI = (PFNGLXSWAPINTERVALSGIPROC) glXGetProcAddress((const GLubyte*) "glXSwapIntervalSGI");
+    g_bufferAge = strstr(glXQueryExtensionsString(g_display, g_screen), "GLX_EXT_buffer_age") != 0;
 
-    if (strstr((const char *) glGetString(GL_EXTENSIONS), "GL_EXT_texture_compression_s3tc"))
-    {
-        glCompressedTexSubImage2D = (PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC) glXGetProcAddress((const GLubyte*) "glCompressedTexSubImage2D");
-        glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC) glXGetProcAddress((const GLubyte*) "glCompressedTexImage2D");
-    }
+    // Core contexts have no GL_EXTENSIONS string; the core backend loads its own entry points.
+    if (!(flags & OS_CORE))
+        load_extensions();
+
+    g_inputRunning = !pthread_create(&g_inputThread, 0, input_thread, 0);
+    if (!g_inputRunning)
+        fatalf("Error: couldn't start the input thread\n");
 }
 
 void osQuit(void)
 {
-    glXDestroyContext(g_display, g_context);
-    XDestroyWindow(g_display, g_window);
-
-    while (g_eventHead)
+    if (g_inputRunning)
     {
-        OS_Event *pending = g_eventHead;
-        g_eventHead = pending->next;
-        if (!g_eventHead)
-            g_eventTail = &g_eventHead;
-        free(pending);
+        // Unblock the input thread with a client message that only it will see.
+        XEvent wake;
+        __atomic_store_n(&g_inputClosing, 1, __ATOMIC_RELEASE);
+        memset(&wake, 0, sizeof(wake));
+        wake.xclient.type = ClientMessage;
+        wake.xclient.window = g_window;
+        wake.xclient.message_type = g_wakeAtom;
+        wake.xclient.format = 32;
+        XSendEvent(g_display, g_window, False, StructureNotifyMask, &wake);
+        XFlush(g_display);
+        pthread_join(g_inputThread, 0);
+        g_inputRunning = 0;
+        g_inputClosing = 0;
     }
 
+    // osInit may have failed partway, so only what was created is torn down.
+    if (g_context)
+        glXDestroyContext(g_display, g_context);
+    if (g_window)
+        XDestroyWindow(g_display, g_window);
+    if (g_inputDisplay)
+        XCloseDisplay(g_inputDisplay);
+    if (g_display)
+        XCloseDisplay(g_display);
+    g_context = 0;
+    g_window = 0;
+    g_inputDisplay = 0;
+    g_display = 0;
 }
 
 int osGetScreenWidth()
@@ -126,111 +240,52 @@ unsigned int osGetMilliseconds()
     return tp.tv_sec * 1000 + tp.tv_usec / 1000;
 }
 
-int osPollEvent(struct OS_EventRec *e)
+unsigned long long osGetMicroseconds()
 {
-    if (XPending(g_display))
-    {
-        OS_Event e;
-        XEvent event;
-        e.type = OS_NOEVENT;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-        XNextEvent(g_display, &event);
-        switch (event.type)
-        {
-          case Expose:
-            //redraw(g_display, event.xany.window);
-            break;
+int osPollEvent(struct OS_EventRec *e)
+{
+    unsigned int tail = __atomic_load_n(&g_eventTail, __ATOMIC_ACQUIRE);
 
-          case ConfigureNotify:
-            //resize(event.xconfigure.width, event.xconfigure.height);
-            break;
+    if (g_eventHead == tail)
+        return 0;
 
-          case KeyRelease:
-          case KeyPress:
-          {
-            XComposeStatus composeStatus;
-            char asciiCode[32];
-            KeySym keySym;
-            int len;
-
-            if (event.type == KeyPress)
-            {     
-                e.type = OS_KEYDOWN;
-                e.key.state = OSKS_DOWN;
-            }
-            else
-            {
-                e.type = OS_KEYUP;
-                e.key.state = OSKS_UP;
-            }
+    memcpy(e, g_events + (g_eventHead & (EVENT_CAPACITY - 1)), sizeof(OS_Event));
+    __atomic_store_n(&g_eventHead, g_eventHead + 1, __ATOMIC_RELEASE);
+    return 1;
+}
 
-            // Check for the ASCII/KeySym codes associated with the event:
-            len = XLookupString(&event.xkey, asciiCode, sizeof(asciiCode), &keySym, &composeStatus);
+void osSwapBuffers()
+{
+    glXSwapBuffers(g_display, g_window);
+}
 
-            // ASCII Key
-            if (len > 0)
-            {
-                e.key.key = (unsigned char) asciiCode[0];
-            }
-            else // use defines from /usr/include/X11/keysymdef.h
-            {
-                switch (keySym)
-                {
-                  case XK_Left:  e.key.key = OSK_LEFT;    break;
-                  case XK_Right: e.key.key = OSK_RIGHT;   break;
-                  case XK_Up:    e.key.key = OSK_UP;      break;
-                  case XK_Down:  e.key.key = OSK_DOWN;    break;
-                  case XK_Next:  e.key.key = OSK_NEXT;    break;
-                  case XK_KP_Insert:
-                  case XK_KP_0:  e.key.key = OSK_NUMPAD0; break;
-                  case XK_KP_End:
-                  case XK_KP_1:  e.key.key = OSK_NUMPAD1; break;
-                  case XK_KP_Down:
-                  case XK_KP_2:  e.key.key = OSK_NUMPAD2; break;
-                  case XK_KP_Page_Down:
-                  case XK_KP_3:  e.key.key = OSK_NUMPAD3; break;
-                  case XK_KP_Left:
-                  case XK_KP_4:  e.key.key = OSK_NUMPAD4; break;
-                  case XK_KP_Begin:
-                  case XK_KP_5:  e.key.key = OSK_NUMPAD5; break;
-                  case XK_KP_Right:
-                  case XK_KP_6:  e.key.key = OSK_NUMPAD6; break;
-                  case XK_KP_Home:
-                  case XK_KP_7:  e.key.key = OSK_NUMPAD7; break;
-                  case XK_KP_Up:
-                  case XK_KP_8:  e.key.key = OSK_NUMPAD8; break;
-                  case XK_KP_Page_Up:
-                  case XK_KP_9:  e.key.key = OSK_NUMPAD9; break;
-                }
-            }
-          }
-          break;
-        }
+// From GLX_EXT_buffer_age: how many swaps ago the back buffer was drawn, or 0 if its
+// contents are undefined.
+int osBufferAge()
+{
+    unsigned int age = 0;
 
-        if (e.type != OS_NOEVENT)
-        {
-            e.next = 0;
-            *g_eventTail = (OS_Event*) malloc(sizeof(OS_Event));
-            memcpy(*g_eventTail, &e, sizeof(OS_Event));
-            g_eventTail = &((*g_eventTail)->next);
-        }
-    }
+    if (g_bufferAge)
+        glXQueryDrawable(g_display, g_window, GLX_BACK_BUFFER_AGE_EXT, &age);
+    return (int) age;
+}
 
-    if (g_eventHead)
-    {
-        OS_Event *pending = g_eventHead;
-        memcpy(e, pending, sizeof(OS_Event));
-        g_eventHead = pending->next;
-        if (!g_eventHead)
-            g_eventTail = &g_eventHead;
-        free(pending);
-        return 1;
-    }
+void *osGetProcAddress(const char *name)
+{
+    return (void *) glXGetProcAddress((const GLubyte*) name);
 }
 
-void osSwapBuffers()
+// Shows a frame rendered on the CPU, bottom row first.  The software renderer never
+// touches the matrices, so the raster position maps to the lower-left corner.
+void osPresent(const unsigned char *rgba, int width, int height)
 {
-    glXSwapBuffers(g_display, g_window);
+    glRasterPos2f(-1, -1);
+    glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
 }
 
 int osShowCursor(int)
@@ -247,3 +302,153 @@ void osGetWindowPos(int *x, int *y)
 void osMoveWindow(int x, int y)
 {
 }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void load_extensions()
+{
+    if (strstr((const char *) glGetString(GL_EXTENSIONS), "GL_EXT_texture_compression_s3tc"))
+    {
+        glCompressedTexSubImage2D = (PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC) glXGetProcAddress((const GLubyte*) "glCompressedTexSubImage2D");
+        glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC) glXGetProcAddress((const GLubyte*) "glCompressedTexImage2D");
+    }
+
+    // Buffer objects are core in 1.5; older drivers may still expose the ARB extension.
+    if (atof((const char *) glGetString(GL_VERSION)) >= 1.5)
+    {
+        glGenBuffers = (PFNGLGENBUFFERSPROC) glXGetProcAddress((const GLubyte*) "glGenBuffers");
+        glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) glXGetProcAddress((const GLubyte*) "glDeleteBuffers");
+        glBindBuffer = (PFNGLBINDBUFFERPROC) glXGetProcAddress((const GLubyte*) "glBindBuffer");
+        glBufferData = (PFNGLBUFFERDATAPROC) glXGetProcAddress((const GLubyte*) "glBufferData");
+    }
+    else if (strstr((const char *) glGetString(GL_EXTENSIONS), "GL_ARB_vertex_buffer_object"))
+    {
+        glGenBuffers = (PFNGLGENBUFFERSPROC) glXGetProcAddress((const GLubyte*) "glGenBuffersARB");
+        glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) glXGetProcAddress((const GLubyte*) "glDeleteBuffersARB");
+        glBindBuffer = (PFNGLBINDBUFFERPROC) glXGetProcAddress((const GLubyte*) "glBindBufferARB");
+        glBufferData = (PFNGLBUFFERDATAPROC) glXGetProcAddress((const GLubyte*) "glBufferDataARB");
+    }
+}
+
+static void *input_thread(void *)
+{
+    XEvent event;
+    OS_Event e;
+
+    TRACE_THREAD("input");
+    while (1)
+    {
+        XNextEvent(g_inputDisplay, &event);
+
+        if (event.type == ClientMessage && event.xclient.message_type == g_wakeAtom)
+            break;
+
+        e.timestamp = osGetMicroseconds();
+        if (translate_event(&event, &e))
+        {
+            TRACE_INSTANT("input");
+            push_event(&e);
+        }
+    }
+
+    return 0;
+}
+
+static int translate_event(XEvent *event, OS_Event *e)
+{
+    e->type = OS_NOEVENT;
+    e->next = 0;
+
+    switch (event->type)
+    {
+      case Expose:
+        //redraw(g_display, event->xany.window);
+        break;
+
+      case ConfigureNotify:
+        e->type = OS_RESIZE;
+        e->resize.width = event->xconfigure.width;
+        e->resize.height = event->xconfigure.height;
+        break;
+
+      case KeyRelease:
+      case KeyPress:
+      {
+        XComposeStatus composeStatus;
+        char asciiCode[32];
+        KeySym keySym;
+        int len;
+
+        if (event->type == KeyPress)
+        {
+            e->type = OS_KEYDOWN;
+            e->key.state = OSKS_DOWN;
+        }
+        else
+        {
+            e->type = OS_KEYUP;
+            e->key.state = OSKS_UP;
+        }
+
+        // Check for the ASCII/KeySym codes associated with the event:
+        len = XLookupString(&event->xkey, asciiCode, sizeof(asciiCode), &keySym, &composeStatus);
+
+        // ASCII Key
+        if (len > 0)
+        {
+            e->key.key = (unsigned char) asciiCode[0];
+        }
+        else // use defines from /usr/include/X11/keysymdef.h
+        {
+            switch (keySym)
+            {
+              case XK_Left:  e->key.key = OSK_LEFT;    break;
+              case XK_Right: e->key.key = OSK_RIGHT;   break;
+              case XK_Up:    e->key.key = OSK_UP;      break;
+              case XK_Down:  e->key.key = OSK_DOWN;    break;
+              case XK_Next:  e->key.key = OSK_NEXT;    break;
+              case XK_KP_Insert:
+              case XK_KP_0:  e->key.key = OSK_NUMPAD0; break;
+              case XK_KP_End:
+              case XK_KP_1:  e->key.key = OSK_NUMPAD1; break;
+              case XK_KP_Down:
+              case XK_KP_2:  e->key.key = OSK_NUMPAD2; break;
+              case XK_KP_Page_Down:
+              case XK_KP_3:  e->key.key = OSK_NUMPAD3; break;
+              case XK_KP_Left:
+              case XK_KP_4:  e->key.key = OSK_NUMPAD4; break;
+              case XK_KP_Begin:
+              case XK_KP_5:  e->key.key = OSK_NUMPAD5; break;
+              case XK_KP_Right:
+              case XK_KP_6:  e->key.key = OSK_NUMPAD6; break;
+              case XK_KP_Home:
+              case XK_KP_7:  e->key.key = OSK_NUMPAD7; break;
+              case XK_KP_Up:
+              case XK_KP_8:  e->key.key = OSK_NUMPAD8; break;
+              case XK_KP_Page_Up:
+              case XK_KP_9:  e->key.key = OSK_NUMPAD9; break;
+              default:       e->key.key = 0;           break;
+            }
+        }
+      }
+      break;
+    }
+
+    return e->type != OS_NOEVENT;
+}
+
+static void push_event(const OS_Event *e)
+{
+    // The main thread drains the ring every frame, so a full ring only needs a short wait,
+    // unless it has stopped to shut down, when nothing will drain it again and the event
+    // is dropped so the thread can reach the wake message.
+    while (g_eventTail - __atomic_load_n(&g_eventHead, __ATOMIC_ACQUIRE) >= EVENT_CAPACITY)
+    {
+        if (__atomic_load_n(&g_inputClosing, __ATOMIC_ACQUIRE))
+            return;
+        sched_yield();
+    }
+
+    memcpy(g_events + (g_eventTail & (EVENT_CAPACITY - 1)), e, sizeof(OS_Event));
+    __atomic_store_n(&g_eventTail, g_eventTail + 1, __ATOMIC_RELEASE);
+}
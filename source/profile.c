@@ -0,0 +1,151 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "profile.h"
+
+#ifdef PROFILE
+
+// Must be a power of two.
+#define WINDOW_SIZE 256
+
+typedef struct
+{
+    unsigned long long start;
+    unsigned int total;
+    int hit;
+    unsigned int samples[WINDOW_SIZE];
+    unsigned int count;
+} PhaseRec;
+
+static PhaseRec phases[PHASE_COUNT];
+static PhaseRec counters[COUNTER_COUNT];
+static int visible = 0;
+
+static const char *names[PHASE_COUNT] =
+{
+    "events",
+    "update",
+    "draw",
+    "swap",
+    "  background",
+    "  tiles",
+    "  guide/next",
+    "  text",
+    "  background gpu",
+    "  tiles gpu",
+    "  guide/next gpu",
+    "  text gpu",
+    "input latency",
+};
+
+static const char *counter_names[COUNTER_COUNT] =
+{
+    "gl state calls",
+    "  elided",
+    "stream waits",
+};
+
+static void roll(PhaseRec *p);
+static int summarize(const PhaseRec *p, unsigned int *sorted);
+static int compare(const void *a, const void *b);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void profile_begin(Phase phase)
+{
+    phases[phase].start = osGetMicroseconds();
+}
+
+void profile_end(Phase phase)
+{
+    PhaseRec *p = phases + phase;
+    p->total += (unsigned int) (osGetMicroseconds() - p->start);
+    p->hit = 1;
+}
+
+void profile_sample(Phase phase, unsigned int microseconds)
+{
+    PhaseRec *p = phases + phase;
+    p->total += microseconds;
+    p->hit = 1;
+}
+
+void profile_count(Counter counter, unsigned int count)
+{
+    PhaseRec *p = counters + counter;
+    p->total += count;
+    p->hit = 1;
+}
+
+void profile_frame()
+{
+    int i;
+    for (i = 0; i < PHASE_COUNT; i++)
+        roll(phases + i);
+    for (i = 0; i < COUNTER_COUNT; i++)
+        roll(counters + i);
+}
+
+void profile_toggle()
+{
+    visible = !visible;
+}
+
+int profile_visible()
+{
+    return visible;
+}
+
+void profile_report(char *text, int size)
+{
+    unsigned int sorted[WINDOW_SIZE];
+    int i, n, written;
+
+    written = snprintf(text, size, "phase   p50 / p99 / max (ms)\n");
+    for (i = 0; i < PHASE_COUNT && written < size; i++)
+    {
+        n = summarize(phases + i, sorted);
+        if (!n)
+            continue;
+        written += snprintf(text + written, size - written, "%s  %.2f / %.2f / %.2f\n", names[i],
+            sorted[n / 2] / 1000.0f, sorted[(n * 99) / 100] / 1000.0f, sorted[n - 1] / 1000.0f);
+    }
+    for (i = 0; i < COUNTER_COUNT && written < size; i++)
+    {
+        n = summarize(counters + i, sorted);
+        if (!n)
+            continue;
+        written += snprintf(text + written, size - written, "%s  %u / %u / %u\n", counter_names[i],
+            sorted[n / 2], sorted[(n * 99) / 100], sorted[n - 1]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void roll(PhaseRec *p)
+{
+    if (!p->hit)
+        return;
+    p->samples[p->count++ & (WINDOW_SIZE - 1)] = p->total;
+    p->total = 0;
+    p->hit = 0;
+}
+
+// Sorts the window's samples into sorted and returns how many there are.
+static int summarize(const PhaseRec *p, unsigned int *sorted)
+{
+    int n = min(p->count, WINDOW_SIZE);
+    memcpy(sorted, p->samples, n * sizeof(unsigned int));
+    qsort(sorted, n, sizeof(unsigned int), compare);
+    return n;
+}
+
+static int compare(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return (x > y) - (x < y);
+}
+
+#endif
@@ -0,0 +1,148 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// GPU timing of the draw passes, for the GL backends.  GL runs behind the CPU, so the
+// CPU timers around the draw_* calls only measure recording; instead, each unbroken
+// run of a pass in the replayed batches is bracketed by a GL_TIME_ELAPSED query, from
+// GL_ARB_timer_query, GL_EXT_timer_query or GL 3.3.  The queries go round a ring of
+// frames and are read back QUERY_LATENCY frames later, by which time the GPU has long
+// finished them, so profiling never stalls the pipeline; a result that still isn't
+// ready is dropped rather than waited for.
+
+#include "os.h"
+#include "profile.h"
+#include "GL/gl.h"
+#include "GL/glext.h"
+
+#ifdef PROFILE
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+#define QUERY_LATENCY 4
+
+// Enough for every pass in every damaged rectangle.
+#define QUERY_CAPACITY 64
+
+typedef void (APIENTRY *GenQueriesProc)(GLsizei count, GLuint *queries);
+typedef void (APIENTRY *DeleteQueriesProc)(GLsizei count, const GLuint *queries);
+typedef void (APIENTRY *BeginQueryProc)(GLenum target, GLuint query);
+typedef void (APIENTRY *EndQueryProc)(GLenum target);
+typedef void (APIENTRY *GetQueryObjectivProc)(GLuint query, GLenum name, GLint *value);
+typedef void (APIENTRY *GetQueryObjectui64vProc)(GLuint query, GLenum name, unsigned long long *value);
+
+static GenQueriesProc glGenQueries;
+static DeleteQueriesProc glDeleteQueries;
+static BeginQueryProc glBeginQuery;
+static EndQueryProc glEndQuery;
+static GetQueryObjectivProc glGetQueryObjectiv;
+static GetQueryObjectui64vProc glGetQueryObjectui64v;
+
+static struct
+{
+    int enabled;
+    GLuint queries[QUERY_LATENCY][QUERY_CAPACITY];
+    unsigned char phases[QUERY_LATENCY][QUERY_CAPACITY];
+    int counts[QUERY_LATENCY];
+    unsigned int frame;
+    int pass;
+} timers;
+
+static int has_timer_query();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void profile_gpu_init()
+{
+    memset(&timers, 0, sizeof(timers));
+    if (!has_timer_query())
+        return;
+
+    glGenQueries = (GenQueriesProc) osGetProcAddress("glGenQueries");
+    glDeleteQueries = (DeleteQueriesProc) osGetProcAddress("glDeleteQueries");
+    glBeginQuery = (BeginQueryProc) osGetProcAddress("glBeginQuery");
+    glEndQuery = (EndQueryProc) osGetProcAddress("glEndQuery");
+    glGetQueryObjectiv = (GetQueryObjectivProc) osGetProcAddress("glGetQueryObjectiv");
+    glGetQueryObjectui64v = (GetQueryObjectui64vProc) osGetProcAddress("glGetQueryObjectui64v");
+    if (!glGetQueryObjectui64v)
+        glGetQueryObjectui64v = (GetQueryObjectui64vProc) osGetProcAddress("glGetQueryObjectui64vEXT");
+    if (!glGenQueries || !glDeleteQueries || !glBeginQuery || !glEndQuery || !glGetQueryObjectiv || !glGetQueryObjectui64v)
+        return;
+
+    glGenQueries(QUERY_LATENCY * QUERY_CAPACITY, timers.queries[0]);
+    timers.enabled = 1;
+}
+
+void profile_gpu_shutdown()
+{
+    if (!timers.enabled)
+        return;
+    profile_gpu_pass(0);
+    glDeleteQueries(QUERY_LATENCY * QUERY_CAPACITY, timers.queries[0]);
+    timers.enabled = 0;
+}
+
+// Collects the oldest frame's results and hands its queries to the new frame.
+void profile_gpu_frame()
+{
+    int slot, i;
+
+    if (!timers.enabled)
+        return;
+
+    profile_gpu_pass(0);
+    slot = ++timers.frame % QUERY_LATENCY;
+    for (i = 0; i < timers.counts[slot]; i++)
+    {
+        GLuint query = timers.queries[slot][i];
+        GLint available = 0;
+        unsigned long long elapsed;
+
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        profile_sample((Phase) timers.phases[slot][i], (unsigned int) ((elapsed + 500) / 1000));
+    }
+    timers.counts[slot] = 0;
+}
+
+// Ends the running query, if any, and starts one for the given pass unless it's 0.
+void profile_gpu_pass(int phase)
+{
+    int slot = timers.frame % QUERY_LATENCY;
+
+    if (!timers.enabled || phase == timers.pass)
+        return;
+
+    if (timers.pass)
+        glEndQuery(GL_TIME_ELAPSED);
+    timers.pass = 0;
+
+    if (phase && timers.counts[slot] < QUERY_CAPACITY)
+    {
+        int n = timers.counts[slot]++;
+        timers.phases[slot][n] = (unsigned char) phase;
+        glBeginQuery(GL_TIME_ELAPSED, timers.queries[slot][n]);
+        timers.pass = phase;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Timer queries are core from 3.3, where the extension string may not be queryable.
+static int has_timer_query()
+{
+    const char *version = (const char *) glGetString(GL_VERSION);
+    const char *extensions;
+    int major = 0, minor = 0;
+
+    if (version && sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 3 || (major == 3 && minor >= 3)))
+        return 1;
+
+    extensions = (const char *) glGetString(GL_EXTENSIONS);
+    return extensions && (strstr(extensions, "GL_ARB_timer_query") || strstr(extensions, "GL_EXT_timer_query"));
+}
+
+#endif
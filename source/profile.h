@@ -0,0 +1,77 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+
+typedef enum
+{
+    EPhaseEvents,
+    EPhaseUpdate,
+    EPhaseDraw,
+    EPhaseSwap,
+    EPhaseBackground,
+    EPhaseTiles,
+    EPhaseNext,
+    EPhaseText,
+    EPhaseGpuBackground,
+    EPhaseGpuTiles,
+    EPhaseGpuNext,
+    EPhaseGpuText,
+    EPhaseLatency,
+} Phase;
+
+#define PHASE_COUNT 13
+
+// Per-frame event counts, reported alongside the phases.
+typedef enum
+{
+    ECounterStateIssued,
+    ECounterStateElided,
+    ECounterStreamWaits,
+} Counter;
+
+#define COUNTER_COUNT 3
+
+// Build with -DPROFILE to enable the timers; otherwise every macro expands to nothing.
+#ifdef PROFILE
+
+void profile_begin(Phase);
+void profile_end(Phase);
+void profile_sample(Phase, unsigned int microseconds);
+void profile_count(Counter, unsigned int count);
+void profile_frame();
+void profile_toggle();
+int  profile_visible();
+void profile_report(char *text, int size);
+
+// GPU time for the EPhaseGpu* phases, from timer queries; see profile.gl.c.  The GL
+// backends start a frame's queries before replaying it, and switch to each batch's
+// pass as they go; pass 0 stops timing.
+void profile_gpu_init();
+void profile_gpu_shutdown();
+void profile_gpu_frame();
+void profile_gpu_pass(int phase);
+
+#define PROFILE_BEGIN(phase)          profile_begin(phase)
+#define PROFILE_END(phase)            profile_end(phase)
+#define PROFILE_SAMPLE(phase, usec)   profile_sample(phase, usec)
+#define PROFILE_COUNT(counter, count) profile_count(counter, count)
+#define PROFILE_FRAME()               profile_frame()
+#define PROFILE_GPU_INIT()            profile_gpu_init()
+#define PROFILE_GPU_SHUTDOWN()        profile_gpu_shutdown()
+#define PROFILE_GPU_FRAME()           profile_gpu_frame()
+#define PROFILE_GPU_PASS(phase)       profile_gpu_pass(phase)
+
+#else
+
+#define PROFILE_BEGIN(phase)          ((void) 0)
+#define PROFILE_END(phase)            ((void) 0)
+#define PROFILE_SAMPLE(phase, usec)   ((void) 0)
+#define PROFILE_COUNT(counter, count) ((void) (count))
+#define PROFILE_FRAME()               ((void) 0)
+#define PROFILE_GPU_INIT()            ((void) 0)
+#define PROFILE_GPU_SHUTDOWN()        ((void) 0)
+#define PROFILE_GPU_FRAME()           ((void) 0)
+#define PROFILE_GPU_PASS(phase)       ((void) 0)
+
+#endif
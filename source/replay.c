@@ -0,0 +1,112 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "replay.h"
+
+// The file is plain text, one event per line, so that sessions can be trimmed or
+// written by hand:
+//
+//     tetrita-replay 1
+//     seed 1192631337
+//     51 press 0
+//     51 release 0
+//     ...
+//     end 2404
+
+#define REPLAY_VERSION 1
+
+static void add_event(Replay *replay, unsigned int frame, int pressed, Button button);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Events are written as they happen, so a crash still leaves a usable session.
+Replay *replay_record(const char *filename, unsigned int seed)
+{
+    Replay *replay;
+    FILE *file = fopen(filename, "w");
+
+    if (!file)
+        return 0;
+
+    replay = (Replay *) calloc(1, sizeof(Replay));
+    replay->seed = seed;
+    replay->file = file;
+    fprintf(file, "tetrita-replay %d\nseed %u\n", REPLAY_VERSION, seed);
+    return replay;
+}
+
+Replay *replay_load(const char *filename)
+{
+    Replay *replay;
+    FILE *file = fopen(filename, "r");
+    char action[16];
+    unsigned int frame;
+    int version, button;
+
+    if (!file)
+        return 0;
+
+    if (fscanf(file, " tetrita-replay %d", &version) != 1 || version != REPLAY_VERSION)
+    {
+        fclose(file);
+        return 0;
+    }
+
+    replay = (Replay *) calloc(1, sizeof(Replay));
+    if (fscanf(file, " seed %u", &replay->seed) != 1)
+    {
+        fclose(file);
+        replay_close(replay, 0);
+        return 0;
+    }
+
+    // A session without an end marker was cut short; it runs until the last event.
+    while (fscanf(file, " %u %15s %d", &frame, action, &button) == 3)
+    {
+        add_event(replay, frame, !strcmp(action, "press"), (Button) button);
+        replay->frames = frame;
+    }
+    if (fscanf(file, " end %u", &frame) == 1)
+        replay->frames = frame;
+
+    fclose(file);
+    return replay;
+}
+
+void replay_event(Replay *replay, unsigned int frame, int pressed, Button button)
+{
+    if (replay->file)
+        fprintf(replay->file, "%u %s %d\n", frame, pressed ? "press" : "release", (int) button);
+    else
+        add_event(replay, frame, pressed, button);
+}
+
+void replay_close(Replay *replay, unsigned int frames)
+{
+    if (replay->file)
+    {
+        fprintf(replay->file, "end %u\n", frames);
+        fclose(replay->file);
+    }
+    free(replay->events);
+    free(replay);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void add_event(Replay *replay, unsigned int frame, int pressed, Button button)
+{
+    ReplayEvent *event;
+
+    if (replay->count == replay->capacity)
+    {
+        replay->capacity = max(64, 2 * replay->capacity);
+        replay->events = (ReplayEvent *) realloc(replay->events, replay->capacity * sizeof(ReplayEvent));
+    }
+
+    event = replay->events + replay->count++;
+    event->frame = frame;
+    event->pressed = pressed;
+    event->button = button;
+}
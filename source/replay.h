@@ -0,0 +1,31 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+#include "game.h"
+
+// A session is the rand() seed plus every button press and release, stamped with the
+// number of game_update calls made before it.  The game is otherwise deterministic,
+// so replaying the events against the same seed reproduces every frame.
+
+typedef struct
+{
+    unsigned int frame;
+    int pressed;
+    Button button;
+} ReplayEvent;
+
+typedef struct ReplayRec
+{
+    unsigned int seed;
+    unsigned int frames;
+    ReplayEvent *events;
+    int count;
+    int capacity;
+    FILE *file;
+} Replay;
+
+Replay *replay_record(const char *filename, unsigned int seed);
+Replay *replay_load(const char *filename);
+void    replay_event(Replay *, unsigned int frame, int pressed, Button);
+void    replay_close(Replay *, unsigned int frames);
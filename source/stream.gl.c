@@ -0,0 +1,275 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+// Streaming vertex buffers for the GL backends.  Where GL 4.4 or GL_ARB_buffer_storage
+// allows, the buffer is allocated once, mapped persistently and coherently, and split
+// into STREAM_REGIONS regions that successive frames take in turn; each frame's region
+// is fenced when the next frame begins, and only reused once that fence has passed, so
+// writing never races the GPU and never reallocates.  Otherwise the store is orphaned
+// with a null glBufferData at the start of each frame and filled with glBufferSubData.
+// Both stream_begin and stream_write may leave the buffer bound to GL_ARRAY_BUFFER.
+
+#include "os.h"
+#include "image.h"
+#include "stream.h"
+#include "profile.h"
+#include "GL/gl.h"
+#include "GL/glext.h"
+
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT                0x0002
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT           0x0040
+#define GL_MAP_COHERENT_BIT             0x0080
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE   0x9117
+#define GL_ALREADY_SIGNALED             0x911A
+#define GL_TIMEOUT_EXPIRED              0x911B
+#define GL_CONDITION_SATISFIED          0x911C
+#define GL_SYNC_FLUSH_COMMANDS_BIT      0x00000001
+#endif
+
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS               0x821D
+#endif
+
+#define STORAGE_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+// How long a single wait on a fence lasts before it is retried, in nanoseconds.
+#define FENCE_TIMEOUT 1000000
+
+typedef struct __GLsync *Sync;
+
+// The bundled glext.h predates most of these, so they're declared here.  The buffer
+// object functions fall back to their ARB names on 1.4 drivers with the extension.
+#define STREAM_FUNCTIONS(F) \
+    F(void, glGenBuffers, (GLsizei count, GLuint *buffers)) \
+    F(void, glDeleteBuffers, (GLsizei count, const GLuint *buffers)) \
+    F(void, glBindBuffer, (GLenum target, GLuint buffer)) \
+    F(void, glBufferData, (GLenum target, GLsizeiptr size, const void *data, GLenum usage)) \
+    F(void, glBufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size, const void *data)) \
+    F(void, glBufferStorage, (GLenum target, GLsizeiptr size, const void *data, GLbitfield flags)) \
+    F(void *, glMapBufferRange, (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)) \
+    F(GLboolean, glUnmapBuffer, (GLenum target)) \
+    F(Sync, glFenceSync, (GLenum condition, GLbitfield flags)) \
+    F(GLenum, glClientWaitSync, (Sync sync, GLbitfield flags, unsigned long long timeout)) \
+    F(void, glDeleteSync, (Sync sync)) \
+    F(const GLubyte *, glGetStringi, (GLenum name, GLuint index))
+
+#define DECLARE(type, name, params) typedef type (APIENTRY *name##Proc) params; static name##Proc name;
+STREAM_FUNCTIONS(DECLARE)
+#undef DECLARE
+
+static struct
+{
+    int loaded;
+    int persistent;
+} streams;
+
+static void load();
+static void *load_function(const char *name);
+static int has_buffer_storage();
+static void allocate(Stream *stream);
+static void release(Stream *stream);
+static int wait_fence(Sync fence);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A zeroed buffer name means the driver has no buffer objects, and the caller should
+// draw from client arrays instead.
+void stream_create(Stream *stream, int capacity)
+{
+    memset(stream, 0, sizeof(*stream));
+    if (!streams.loaded)
+        load();
+    if (!glGenBuffers || !glDeleteBuffers || !glBindBuffer || !glBufferData || !glBufferSubData)
+        return;
+
+    stream->capacity = npot(max(capacity, 1));
+    allocate(stream);
+}
+
+void stream_destroy(Stream *stream)
+{
+    release(stream);
+    memset(stream, 0, sizeof(*stream));
+}
+
+// Fences the previous frame's region and moves on to the next, waiting for the GPU to
+// finish reading it if it's still in flight.  The buffer only grows here, so everything
+// written during a frame stays in one buffer.
+void stream_begin(Stream *stream, int size)
+{
+    int waits = 0;
+
+    if (!stream->buffer)
+        return;
+
+    if (size > stream->capacity)
+    {
+        release(stream);
+        while (stream->capacity < size)
+            stream->capacity *= 2;
+        allocate(stream);
+    }
+    else if (stream->mapped)
+    {
+        Sync *fences = (Sync *) stream->fences;
+        if (fences[stream->region])
+            glDeleteSync(fences[stream->region]);
+        fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        stream->region = (stream->region + 1) % STREAM_REGIONS;
+        if (fences[stream->region])
+        {
+            waits = wait_fence(fences[stream->region]);
+            glDeleteSync(fences[stream->region]);
+            fences[stream->region] = 0;
+        }
+    }
+
+    if (!stream->mapped)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+        glBufferData(GL_ARRAY_BUFFER, stream->capacity, 0, GL_STREAM_DRAW);
+    }
+    stream->used = 0;
+    PROFILE_COUNT(ECounterStreamWaits, waits);
+}
+
+int stream_write(Stream *stream, const void *data, int size)
+{
+    int offset = stream->used;
+
+    assert(stream->used + size <= stream->capacity);
+    if (stream->mapped)
+    {
+        offset += stream->region * stream->capacity;
+        memcpy(stream->mapped + offset, data, size);
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    }
+    stream->used += size;
+    return offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void load()
+{
+#define LOAD(type, name, params) name = (name##Proc) load_function(#name);
+    STREAM_FUNCTIONS(LOAD)
+#undef LOAD
+
+    streams.loaded = 1;
+    streams.persistent = glBufferStorage && glMapBufferRange && glUnmapBuffer &&
+        glFenceSync && glClientWaitSync && glDeleteSync && has_buffer_storage();
+}
+
+static void *load_function(const char *name)
+{
+    char suffixed[64];
+    void *function = osGetProcAddress(name);
+
+    if (!function)
+    {
+        snprintf(suffixed, sizeof(suffixed), "%sARB", name);
+        function = osGetProcAddress(suffixed);
+    }
+    return function;
+}
+
+// Core contexts only list their extensions through glGetStringi.
+static int has_buffer_storage()
+{
+    const char *version = (const char *) glGetString(GL_VERSION);
+    const char *extensions;
+    int major = 0, minor = 0;
+    GLint count = 0;
+    int i;
+
+    if (version && sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 4 || (major == 4 && minor >= 4)))
+        return 1;
+
+    if (major < 3 || !glGetStringi)
+    {
+        extensions = (const char *) glGetString(GL_EXTENSIONS);
+        return extensions && strstr(extensions, "GL_ARB_buffer_storage");
+    }
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i = 0; i < count; i++)
+    {
+        if (!strcmp((const char *) glGetStringi(GL_EXTENSIONS, i), "GL_ARB_buffer_storage"))
+            return 1;
+    }
+    return 0;
+}
+
+// The persistent store holds every region; the orphaned one is respecified each frame.
+static void allocate(Stream *stream)
+{
+    GLsizeiptr size = (GLsizeiptr) stream->capacity * STREAM_REGIONS;
+
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+    stream->region = 0;
+    stream->mapped = 0;
+    if (!streams.persistent)
+        return;
+
+    glBufferStorage(GL_ARRAY_BUFFER, size, 0, STORAGE_FLAGS);
+    stream->mapped = (unsigned char *) glMapBufferRange(GL_ARRAY_BUFFER, 0, size, STORAGE_FLAGS);
+    if (stream->mapped)
+        return;
+
+    // An immutable store can't be orphaned, so falling back takes a fresh buffer.
+    streams.persistent = 0;
+    glDeleteBuffers(1, &stream->buffer);
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+}
+
+// The driver keeps the store alive until the GPU is done with it, so the old regions
+// needn't be waited for.
+static void release(Stream *stream)
+{
+    Sync *fences = (Sync *) stream->fences;
+    int i;
+
+    if (!stream->buffer)
+        return;
+
+    for (i = 0; i < STREAM_REGIONS; i++)
+    {
+        if (fences[i])
+            glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+    if (stream->mapped)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &stream->buffer);
+    stream->buffer = 0;
+    stream->mapped = 0;
+}
+
+// Returns whether the GPU was still using the region, which is a stall.
+static int wait_fence(Sync fence)
+{
+    GLenum result = glClientWaitSync(fence, 0, 0);
+
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+        return 0;
+    while (result == GL_TIMEOUT_EXPIRED)
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    return 1;
+}
@@ -0,0 +1,25 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+
+// A vertex buffer for geometry that is rewritten every frame; see stream.gl.c.  Each
+// frame starts with stream_begin, given the most it will write, and each stream_write
+// then returns the byte offset where its data landed in the buffer.
+
+#define STREAM_REGIONS 3
+
+typedef struct StreamRec
+{
+    unsigned int buffer;
+    unsigned char *mapped;
+    void *fences[STREAM_REGIONS];
+    int capacity;
+    int region;
+    int used;
+} Stream;
+
+void stream_create(Stream *, int capacity);
+void stream_destroy(Stream *);
+void stream_begin(Stream *, int size);
+int  stream_write(Stream *, const void *data, int size);
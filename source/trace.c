@@ -0,0 +1,148 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#include "os.h"
+#include "trace.h"
+
+#ifdef TRACE
+
+// Must be a power of two.  At 60 fps this holds well over a minute of frames.
+#define TRACE_CAPACITY 16384
+
+#ifdef WIN32
+#define THREAD_LOCAL __declspec(thread)
+#define LOAD_HEAD(p) InterlockedCompareExchange((volatile LONG *) (p), 0, 0)
+#define STORE_HEAD(p, v) InterlockedExchange((volatile LONG *) (p), (LONG) (v))
+#define LOAD_LIST(p) InterlockedCompareExchangePointer((PVOID volatile *) (p), 0, 0)
+#define SWAP_LIST(p, expected, desired) (InterlockedCompareExchangePointer((PVOID volatile *) (p), desired, expected) == (expected))
+#define INCREMENT(p) InterlockedIncrement((volatile LONG *) (p))
+#else
+#define THREAD_LOCAL __thread
+#define LOAD_HEAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_HEAD(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define LOAD_LIST(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SWAP_LIST(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+#define INCREMENT(p) __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#endif
+
+typedef struct
+{
+    const char *name;
+    unsigned long long timestamp;
+    char phase;
+} TraceEvent;
+
+// Each thread appends to its own ring, so recording never takes a lock.  Only
+// the owning thread writes 'head'; the dumper reads it to find the live range.
+typedef struct TraceBufferRec
+{
+    TraceEvent events[TRACE_CAPACITY];
+    unsigned int head;
+    int tid;
+    const char *name;
+    struct TraceBufferRec *next;
+} TraceBuffer;
+
+static TraceBuffer *buffers = 0;
+static int thread_count = 0;
+static THREAD_LOCAL TraceBuffer *local = 0;
+
+static TraceBuffer *acquire_buffer();
+static void record(const char *name, char phase);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void trace_begin(const char *name)
+{
+    record(name, 'B');
+}
+
+void trace_end(const char *name)
+{
+    record(name, 'E');
+}
+
+void trace_instant(const char *name)
+{
+    record(name, 'i');
+}
+
+void trace_thread(const char *name)
+{
+    acquire_buffer()->name = name;
+}
+
+int trace_dump(const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    TraceEvent *snapshot;
+    const TraceBuffer *buffer;
+    const char *separator = "";
+
+    if (!fp)
+        return 0;
+
+    snapshot = (TraceEvent *) malloc(sizeof(buffer->events));
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (buffer = (const TraceBuffer *) LOAD_LIST(&buffers); buffer; buffer = buffer->next)
+    {
+        unsigned int head = LOAD_HEAD(&buffer->head);
+        unsigned int tail = head >= TRACE_CAPACITY ? head + 1 - TRACE_CAPACITY : 0;
+        unsigned int after, i;
+
+        // The owner keeps recording while we copy, and writes the slot at its head before
+        // publishing it, so only the newest TRACE_CAPACITY - 1 events are kept; anything
+        // it lapped in the meantime is dropped too.
+        memcpy(snapshot, buffer->events, sizeof(buffer->events));
+        after = LOAD_HEAD(&buffer->head);
+        if (after + 1 - tail > TRACE_CAPACITY)
+            tail = min(after + 1 - TRACE_CAPACITY, head);
+
+        if (buffer->name)
+        {
+            fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                separator, buffer->tid, buffer->name);
+            separator = ",";
+        }
+
+        for (i = tail; i != head; i++)
+        {
+            const TraceEvent *e = snapshot + (i & (TRACE_CAPACITY - 1));
+            fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%d%s}",
+                separator, e->name, e->phase, e->timestamp, buffer->tid,
+                e->phase == 'i' ? ",\"s\":\"g\"" : "");
+            separator = ",";
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    free(snapshot);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static TraceBuffer *acquire_buffer()
+{
+    if (!local)
+    {
+        local = (TraceBuffer *) calloc(1, sizeof(TraceBuffer));
+        local->tid = INCREMENT(&thread_count);
+        do
+            local->next = (TraceBuffer *) LOAD_LIST(&buffers);
+        while (!SWAP_LIST(&buffers, local->next, local));
+    }
+    return local;
+}
+
+static void record(const char *name, char phase)
+{
+    TraceBuffer *buffer = acquire_buffer();
+    TraceEvent *e = buffer->events + (buffer->head & (TRACE_CAPACITY - 1));
+    e->name = name;
+    e->timestamp = osGetMicroseconds();
+    e->phase = phase;
+    STORE_HEAD(&buffer->head, buffer->head + 1);
+}
+
+#endif
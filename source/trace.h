@@ -0,0 +1,32 @@
+// Copyright: 2007  Philip Rideout.  All rights reserved.
+// License: see bsd-license.txt
+
+#pragma once
+
+#define TRACE_FILENAME "tetrita.trace.json"
+
+// Build with -DTRACE to record events; otherwise every macro expands to nothing.
+// Names are stored by pointer, so they must be string literals.
+#ifdef TRACE
+
+void trace_begin(const char *name);
+void trace_end(const char *name);
+void trace_instant(const char *name);
+void trace_thread(const char *name);
+int  trace_dump(const char *filename);
+
+#define TRACE_BEGIN(name)     trace_begin(name)
+#define TRACE_END(name)       trace_end(name)
+#define TRACE_INSTANT(name)   trace_instant(name)
+#define TRACE_THREAD(name)    trace_thread(name)
+#define TRACE_DUMP(filename)  trace_dump(filename)
+
+#else
+
+#define TRACE_BEGIN(name)     ((void) 0)
+#define TRACE_END(name)       ((void) 0)
+#define TRACE_INSTANT(name)   ((void) 0)
+#define TRACE_THREAD(name)    ((void) 0)
+#define TRACE_DUMP(filename)  ((void) 0)
+
+#endif